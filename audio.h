@@ -9,22 +9,85 @@
 #include <numeric>
 #include <cmath>
 #include <algorithm>
+#include <array>
 #include <limits>
+#include <memory>
+
+#include "audio_kernels.h"
+#include "audio_memory.h"
+#include "audio_parallel.h"
+
+using audio_kernels::fade_curve;
+using audio_kernels::level_measure;
+
+// The inclusive range [range.first, range.second] of a clip of size frames as
+// the half open [first, last), clamped to the clip with first <= last. The
+// end is widened before the + 1, so a range.second of INT_MAX reaches the end.
+inline std::pair<std::size_t, std::size_t> clamp_range(const std::pair<int, int>& range, std::size_t size){
+  std::size_t first = std::min<std::size_t>(std::max(range.first, 0), size);
+  std::size_t last = std::min<std::size_t>((std::size_t)std::max(range.second, -1) + 1, size);
+  return std::make_pair(first, std::max(first, last));
+}
+
+template<typename T, typename Alloc = aligned_allocator<T>>
+class planar_audio;
+
+template<typename T>
+class audio_view;
+
+namespace audio_expr{
+template<typename E>
+struct expression;
 
 template<typename T>
+struct clip;
+
+template<typename E, typename S>
+void evaluate(const expression<E>& expr, S* out);
+}
+
+// Alloc supplies the sample buffer, e.g. arena_allocator<T> from audio_arena.h
+// for jobs that churn through temporaries; results of an operator share the
+// allocator of the clip they were computed from.
+template<typename T, typename Alloc = std::allocator<T>>
 class audio{
+public:
+  typedef std::vector<T, Alloc> buffer_type;
+
 private:
-  std::vector<T> mono;
+  buffer_type mono;
   int sample_length;
+
+  friend struct audio_expr::clip<T>;
+
+  std::size_t ramp_frames(float number_of_seconds) const{
+    return number_of_seconds > 0 ? (std::size_t)std::lround(number_of_seconds * sample_length) : 0;
+  }
+
+  void scale(float gain){
+    T* samples = mono.data();
+    audio_parallel::for_each_chunk<T>(mono.size(), [&](std::size_t begin, std::size_t end){
+      audio_kernels::apply_channel_gains(samples + begin, end - begin, 1, &gain);
+    });
+  }
 public:
-  audio(size_t dim = 0) : mono(std::vector<T>(dim)){}
+  audio(size_t dim = 0) : mono(dim), sample_length(0){}
+
+  audio(buffer_type lst) : mono(std::move(lst)), sample_length(0){}
 
-  audio(std::vector<T> lst) : mono(lst.size()) {
-		copy(lst.begin(), lst.end(), mono.begin());
-	}
+  audio(buffer_type lst, int sampl_len) : mono(std::move(lst)), sample_length(sampl_len){}
 
-  audio(std::vector<T> lst, int sampl_len) : mono(lst.size()), sample_length(sampl_len){
-    copy(lst.begin(), lst.end(), mono.begin());
+  template<typename E>
+  audio(const audio_expr::expression<E>& expr) : mono(expr.self().size()), sample_length(expr.self().sample_length){
+    audio_expr::evaluate(expr, mono.data());
+  }
+
+  template<typename E>
+  audio& operator=(const audio_expr::expression<E>& expr){
+    mono.resize(expr.self().size());
+    sample_length = expr.self().sample_length;
+    audio_expr::evaluate(expr, mono.data());
+    return *this;
   }
 
   virtual ~audio() = default;
@@ -33,316 +96,1214 @@ public:
 
   audio& operator=(const audio& rhs) = default;
 
-  audio(audio&& rhs) : mono(std::move(rhs.mono)){}
+  audio(audio&& rhs) : mono(std::move(rhs.mono)), sample_length(rhs.sample_length){}
 
   T& operator[] (std::size_t index){
     return mono[index];
   }
 
-  audio operator=(audio&& rhs){
+  const T& operator[] (std::size_t index) const{
+    return mono[index];
+  }
+
+  audio& operator=(audio&& rhs){
     if (this != &rhs){
       this->mono = move(rhs.mono);
-      return *this;
+      this->sample_length = rhs.sample_length;
     }
+    return *this;
   }
 
-  std::vector<T> get_buffer() const{
+  const buffer_type& get_buffer() const{
     return mono;
   }
 
+  const T* data() const{
+    return mono.data();
+  }
+
+  std::size_t size() const{
+    return mono.size();
+  }
+
+  typename buffer_type::const_iterator begin() const{
+    return mono.begin();
+  }
+
+  typename buffer_type::const_iterator end() const{
+    return mono.end();
+  }
+
   int get_sample_length() const{
     return sample_length;
   }
 
-  audio operator|(const audio& rhs){
-    auto temporary_audio = *this;
-    for(auto& value : rhs.mono){
-			temporary_audio.mono.push_back(value);
-		}
-    return temporary_audio;
+  // a clip joined to itself appends a copy, since insert must not read from
+  // the vector it grows
+  audio& operator|=(const audio& rhs){
+    if(&rhs == this){
+      audio copy = rhs;
+      return *this |= copy;
+    }
+    mono.insert(mono.end(), rhs.mono.begin(), rhs.mono.end());
+    return *this;
   }
 
-  audio operator*(const std::pair<float, float>& volume_factor){
-    auto temporary_audio = *this;
-    for(int i = 0; i < this->mono.size(); ++i){
-      temporary_audio.mono[i] = this->mono[i] * volume_factor.first;
-		}
+  audio operator|(const audio& rhs) const&{
+    audio temporary_audio(buffer_type(mono.get_allocator()), sample_length);
+    temporary_audio.mono.reserve(this->mono.size() + rhs.mono.size());
+    temporary_audio.mono.insert(temporary_audio.mono.end(), this->mono.begin(), this->mono.end());
+    temporary_audio.mono.insert(temporary_audio.mono.end(), rhs.mono.begin(), rhs.mono.end());
     return temporary_audio;
   }
 
-  audio operator+(const audio& rhs){
-    auto temporary_audio = *this;
-    for(int i = 0; i < this->mono.size(); ++i){
-       int sum = this->mono[i] + rhs.mono[i];
-      if(sum >= std::numeric_limits<T>::max()){
-        temporary_audio.mono[i] = (T)std::numeric_limits<T>::max();
-      }
-      else{
-        temporary_audio.mono[i] = sum;
-      }
-    }
+  audio operator|(const audio& rhs) &&{
+    *this |= rhs;
+    return std::move(*this);
+  }
+
+  // rhs joined on after an equal-power crossfade of overlap frames, instead
+  // of the butt join of operator|
+  audio crossfade(const audio& rhs, std::size_t overlap) const{
+    audio temporary_audio(buffer_type(mono.get_allocator()), sample_length);
+    view().crossfade_into(rhs.view(), overlap, temporary_audio.mono);
     return temporary_audio;
   }
 
-  audio operator^(const std::pair<int, int>& range){
-    auto temporary_audio = *this;
-    temporary_audio.mono.clear();
-    for(int i = 0; i < this->mono.size(); ++i){
-        if(i < range.first || i > range.second){
-          temporary_audio.mono.push_back(this->mono[i]);
-        }
+  audio& operator*=(const std::pair<float, float>& volume_factor){
+    scale(volume_factor.first);
+    return *this;
+  }
+
+  audio operator*(const std::pair<float, float>& volume_factor) const&{
+    audio temporary_audio = *this;
+    return std::move(temporary_audio) * volume_factor;
+  }
+
+  audio operator*(const std::pair<float, float>& volume_factor) &&{
+    *this *= volume_factor;
+    return std::move(*this);
+  }
+
+  audio& operator+=(const audio& rhs){
+    std::size_t length = std::min(this->mono.size(), rhs.mono.size());
+    T* samples = this->mono.data();
+    const T* other = rhs.mono.data();
+    audio_parallel::for_each_chunk<T>(length, [&](std::size_t begin, std::size_t end){
+      audio_kernels::saturating_add(samples + begin, other + begin, samples + begin, end - begin);
+    });
+    return *this;
+  }
+
+  audio operator+(const audio& rhs) const&{
+    audio temporary_audio = *this;
+    return std::move(temporary_audio) + rhs;
+  }
+
+  audio operator+(const audio& rhs) &&{
+    *this += rhs;
+    return std::move(*this);
+  }
+
+  audio& operator^=(const std::pair<int, int>& range){
+    std::pair<std::size_t, std::size_t> cut = clamp_range(range, mono.size());
+    std::size_t first = cut.first, last = cut.second;
+    if(first < last){
+      mono.erase(mono.begin() + first, mono.begin() + last);
     }
+    return *this;
+  }
+
+  audio operator^(const std::pair<int, int>& range) const&{
+    audio temporary_audio(buffer_type(mono.get_allocator()), sample_length);
+    std::pair<std::size_t, std::size_t> cut = clamp_range(range, mono.size());
+    std::size_t first = cut.first, last = cut.second;
+    temporary_audio.mono.reserve(mono.size() - (last - first));
+    temporary_audio.mono.insert(temporary_audio.mono.end(), mono.begin(), mono.begin() + first);
+    temporary_audio.mono.insert(temporary_audio.mono.end(), mono.begin() + last, mono.end());
     return temporary_audio;
   }
 
+  audio operator^(const std::pair<int, int>& range) &&{
+    *this ^= range;
+    return std::move(*this);
+  }
+
   void reverse (){
    std::reverse(mono.begin(), mono.end());
   }
 
-  audio ranged_add(const std::pair<int, int>& range1, const std::pair<int, int>& range2, const audio& rhs){
-    auto temporary_audio = *this;
-    auto temporary_rhs = rhs;
-    audio<T> result;
-    temporary_rhs.mono = temporary_audio.mono = std::vector<T>(range1.second - range1.first + 1);
-    std::copy(this->mono.begin() + range1.first, this->mono.begin() + range1.second + 1, temporary_audio.mono.begin());
-    std::copy(rhs.mono.begin() + range2.first, rhs.mono.begin() + range2.second + 1, temporary_rhs.mono.begin());
+  audio_view<T> view() const{
+    return audio_view<T>(this->mono.data(), this->mono.size(), sample_length);
+  }
+
+  audio_view<T> view(const std::pair<int, int>& range) const{
+    return view().subview(range);
+  }
 
-    result = temporary_audio + temporary_rhs;
+  audio ranged_add(const std::pair<int, int>& range1, const std::pair<int, int>& range2, const audio& rhs) const{
+    audio_view<T> lhs = view(range1), other = rhs.view(range2);
+    audio result(buffer_type(std::min(lhs.size(), other.size()), T(), mono.get_allocator()), sample_length);
+    lhs.add(other, result.mono.data());
     return result;
   }
 
-  float calculate_rms(){
-    int init = 0;
-    float sum = std::accumulate(this->mono.begin(),
-                                this->mono.end(),
-                                init, [&](T accumulated_sum, T x){return(accumulated_sum + pow(x, 2.0));});
-    return sqrt(sum / this->mono.size());
+  float calculate_rms() const{
+    return view().calculate_rms();
   }
 
-  audio normalize(float current_rms, float desired_rms){
-    auto temporary_audio = *this;
-    std::transform(this->mono.begin(),
-                   this->mono.end(),
-                   temporary_audio.mono.begin(),
-                   [&](T x){return (x *= (desired_rms / current_rms));}
-                 );
+  // rms of the samples in the inclusive range
+  float calculate_rms(const std::pair<int, int>& range) const{
+    return view(range).calculate_rms();
+  }
 
-    return temporary_audio;
+  // a silent clip keeps a gain of one, as in normalize_gains
+  void normalize_in_place(float current_rms, float desired_rms){
+    scale(current_rms > 0 ? desired_rms / current_rms : 1);
   }
 
-  audio fade_in(int number_of_seconds){
-    int fade_sample_no = 1;
-    float ramp_length = number_of_seconds * sample_length;
-    auto temporary_audio = *this;
+  audio normalize(float current_rms, float desired_rms) const&{
+    audio temporary_audio = *this;
+    return std::move(temporary_audio).normalize(current_rms, desired_rms);
+  }
 
-    std::for_each(temporary_audio.mono.begin(),
-                  temporary_audio.mono.end(),
-                  [&fade_sample_no, ramp_length](T x){
-                    while(fade_sample_no < ramp_length){
-                      x = (fade_sample_no / ramp_length) * x;
-                      ++fade_sample_no;
-                    }
-                  }
-                );
+  audio normalize(float current_rms, float desired_rms) &&{
+    normalize_in_place(current_rms, desired_rms);
+    return std::move(*this);
+  }
 
-    return temporary_audio;
+  // scales the clip so that its rms or peak becomes target, with one read
+  // pass to measure and one in-place pass to apply the gain, which saturates
+  void normalize_to_in_place(float target, level_measure measure = level_measure::rms, bool linked = false){
+    *this *= view().normalize_gains(target, measure, linked);
   }
 
-  audio fade_out(int number_of_seconds){
-    int fade_sample_no = 1;
-    float ramp_length = number_of_seconds * sample_length;
-    auto temporary_audio = *this;
+  audio normalize_to(float target, level_measure measure = level_measure::rms, bool linked = false) const&{
+    audio temporary_audio = *this;
+    return std::move(temporary_audio).normalize_to(target, measure, linked);
+  }
 
-    std::for_each(temporary_audio.mono.begin(),
-                  temporary_audio.mono.end(),
-                  [&fade_sample_no, ramp_length](T x){
-                    while(fade_sample_no < ramp_length){
-                      x = (1 - fade_sample_no / ramp_length) * x;
-                      ++fade_sample_no;
-                    }
-                  }
-                );
+  audio normalize_to(float target, level_measure measure = level_measure::rms, bool linked = false) &&{
+    normalize_to_in_place(target, measure, linked);
+    return std::move(*this);
+  }
 
-    return temporary_audio;
+  // applies ramp to the samples it covers; positions are sample indices
+  void apply_envelope(const audio_kernels::envelope& ramp){
+    audio_kernels::apply_envelope(mono.data(), mono.size(), 1, ramp);
+  }
+
+  void fade_in_in_place(float number_of_seconds, fade_curve curve = fade_curve::linear){
+    audio_kernels::envelope ramp = {0, ramp_frames(number_of_seconds), 0, 1, curve};
+    audio_kernels::apply_envelope(mono.data(), mono.size(), 1, ramp);
+  }
+
+  audio fade_in(float number_of_seconds, fade_curve curve = fade_curve::linear) const&{
+    audio temporary_audio = *this;
+    return std::move(temporary_audio).fade_in(number_of_seconds, curve);
+  }
+
+  audio fade_in(float number_of_seconds, fade_curve curve = fade_curve::linear) &&{
+    fade_in_in_place(number_of_seconds, curve);
+    return std::move(*this);
+  }
+
+  // the ramp finishes on the last sample, even when it is longer than the clip
+  void fade_out_in_place(float number_of_seconds, fade_curve curve = fade_curve::linear){
+    std::size_t length = ramp_frames(number_of_seconds), end = std::max(length, mono.size());
+    audio_kernels::envelope ramp = {end - length, length, 1, 0, curve};
+    audio_kernels::apply_envelope(mono.data(), mono.size(), 1, ramp, end - mono.size());
+  }
+
+  audio fade_out(float number_of_seconds, fade_curve curve = fade_curve::linear) const&{
+    audio temporary_audio = *this;
+    return std::move(temporary_audio).fade_out(number_of_seconds, curve);
+  }
+
+  audio fade_out(float number_of_seconds, fade_curve curve = fade_curve::linear) &&{
+    fade_out_in_place(number_of_seconds, curve);
+    return std::move(*this);
   }
 };
 
-template<typename T>
-class audio<std::pair<T, T>>{
+template<typename T, typename Alloc>
+class audio<std::pair<T, T>, Alloc>{
+public:
+  typedef std::vector<std::pair<T, T>, Alloc> buffer_type;
+
 private:
-  std::vector<std::pair<T, T>> stereo;
+  buffer_type stereo;
   int sample_length;
+
+  static_assert(sizeof(std::pair<T, T>) == 2 * sizeof(T), "stereo frames must be two packed samples");
+
+  // interleaved view of the frames as left, right, left, right, ...
+  static T* channels(buffer_type& frames){
+    return reinterpret_cast<T*>(frames.data());
+  }
+
+  static const T* channels(const buffer_type& frames){
+    return reinterpret_cast<const T*>(frames.data());
+  }
+
+  friend struct audio_expr::clip<std::pair<T, T>>;
+
+  std::size_t ramp_frames(float number_of_seconds) const{
+    return number_of_seconds > 0 ? (std::size_t)std::lround(number_of_seconds * sample_length) : 0;
+  }
+
+  void scale(float left, float right){
+    const float gains[2] = {left, right};
+    T* samples = channels(stereo);
+    audio_parallel::for_each_chunk<T>(2 * stereo.size(), [&](std::size_t begin, std::size_t end){
+      audio_kernels::apply_channel_gains(samples + begin, end - begin, 2, gains, begin);
+    });
+  }
 public:
-  audio(size_t dim = 0) : stereo(std::vector<std::pair<T, T>>(dim)){}
+  audio(size_t dim = 0) : stereo(dim), sample_length(0){}
+
+  audio(buffer_type lst) : stereo(std::move(lst)), sample_length(0){}
 
-  audio(std::vector<std::pair<T, T>> lst) : stereo(lst.size()) {
-		copy(lst.begin(), lst.end(), stereo.begin());
-	}
+  audio(buffer_type lst, int sampl_len) : stereo(std::move(lst)), sample_length(sampl_len){}
 
-  audio(std::vector<std::pair<T, T>> lst, int sampl_len) : stereo(lst.size()), sample_length(sampl_len){
-    copy(lst.begin(), lst.end(), stereo.begin());
+  template<typename E>
+  audio(const audio_expr::expression<E>& expr) : stereo(expr.self().size()), sample_length(expr.self().sample_length){
+    audio_expr::evaluate(expr, channels(stereo));
+  }
+
+  template<typename E>
+  audio& operator=(const audio_expr::expression<E>& expr){
+    stereo.resize(expr.self().size());
+    sample_length = expr.self().sample_length;
+    audio_expr::evaluate(expr, channels(stereo));
+    return *this;
   }
 
   virtual ~audio() = default;
 
-  audio(const audio<std::pair<T, T>>& rhs) = default;
+  audio(const audio& rhs) = default;
 
-  audio<std::pair<T, T>>& operator=(const audio<std::pair<T, T>>& rhs) = default;
+  audio& operator=(const audio& rhs) = default;
 
   int get_sample_length() const{
     return sample_length;
   }
 
-  std::vector<std::pair<T, T>> get_buffer() const{
+  std::pair<T, T>& operator[] (std::size_t index){
+    return stereo[index];
+  }
+
+  const std::pair<T, T>& operator[] (std::size_t index) const{
+    return stereo[index];
+  }
+
+  const buffer_type& get_buffer() const{
     return stereo;
   }
 
-  audio(audio<std::pair<T, T>>&& rhs) : stereo(std::move(rhs.stereo)){}
+  const std::pair<T, T>* data() const{
+    return stereo.data();
+  }
+
+  std::size_t size() const{
+    return stereo.size();
+  }
+
+  typename buffer_type::const_iterator begin() const{
+    return stereo.begin();
+  }
 
-  audio<std::pair<T, T>> operator=(audio<std::pair<T, T>>&& rhs){
+  typename buffer_type::const_iterator end() const{
+    return stereo.end();
+  }
+
+  audio(audio&& rhs) : stereo(std::move(rhs.stereo)), sample_length(rhs.sample_length){}
+
+  audio& operator=(audio&& rhs){
     if (this != &rhs){
       this->stereo = move(rhs.stereo);
-      return *this;
+      this->sample_length = rhs.sample_length;
     }
+    return *this;
   }
 
-  audio<std::pair<T, T>> operator|(const audio<std::pair<T, T>>& rhs){
-    auto temporary_audio = *this;
-    for(auto& value : rhs.stereo){
-      temporary_audio.stereo.push_back(value);
+  // a clip joined to itself appends a copy, since insert must not read from
+  // the vector it grows
+  audio& operator|=(const audio& rhs){
+    if(&rhs == this){
+      audio copy = rhs;
+      return *this |= copy;
     }
-    return temporary_audio;
+    stereo.insert(stereo.end(), rhs.stereo.begin(), rhs.stereo.end());
+    return *this;
   }
 
-  audio<std::pair<T, T>> operator*(const std::pair<float, float>& volume_factor){
-    auto temporary_audio = *this;
-    for(auto& value : temporary_audio.stereo){
-       value.first *= volume_factor.first;
-       value.second *= volume_factor.second;
-    }
+  audio operator|(const audio& rhs) const&{
+    audio temporary_audio(buffer_type(stereo.get_allocator()), sample_length);
+    temporary_audio.stereo.reserve(this->stereo.size() + rhs.stereo.size());
+    temporary_audio.stereo.insert(temporary_audio.stereo.end(), this->stereo.begin(), this->stereo.end());
+    temporary_audio.stereo.insert(temporary_audio.stereo.end(), rhs.stereo.begin(), rhs.stereo.end());
     return temporary_audio;
   }
 
-  audio<std::pair<T, T>> operator+(const audio<std::pair<T, T>>& rhs){
-    auto temporary_audio = *this;
-    for(int i = 0; i < temporary_audio.stereo.size(); i++){
-      int sum1 = this->stereo[i].first + rhs.stereo[i].first;
-      if(sum1 >= std::numeric_limits<T>::max()){
-        temporary_audio.stereo[i].first = (T)std::numeric_limits<T>::max();
-      }
-      else{
-        temporary_audio.stereo[i].first = sum1;
-      }
-      int sum2 = this->stereo[i].second + rhs.stereo[i].second;
-      if(sum2 >= std::numeric_limits<T>::max()){
-        temporary_audio.stereo[i].second = (T)std::numeric_limits<T>::max();
-      }
-      else{
-        temporary_audio.stereo[i].second = sum2;
-      }
-    }
+  audio operator|(const audio& rhs) &&{
+    *this |= rhs;
+    return std::move(*this);
+  }
+
+  // rhs joined on after an equal-power crossfade of overlap frames, instead
+  // of the butt join of operator|
+  audio crossfade(const audio& rhs, std::size_t overlap) const{
+    audio temporary_audio(buffer_type(stereo.get_allocator()), sample_length);
+    view().crossfade_into(rhs.view(), overlap, temporary_audio.stereo);
     return temporary_audio;
   }
 
-  audio<std::pair<T, T>> operator^(const std::pair<int, int>& range){
-    auto temporary_audio = *this;
-    temporary_audio.stereo.clear();
-    for(int i = 0; i < this->stereo.size(); ++i){
-        if(i < range.first || i > range.second){
-          temporary_audio.stereo.push_back(this->stereo[i]);
-        }
+  audio& operator*=(const std::pair<float, float>& volume_factor){
+    scale(volume_factor.first, volume_factor.second);
+    return *this;
+  }
+
+  audio operator*(const std::pair<float, float>& volume_factor) const&{
+    audio temporary_audio = *this;
+    return std::move(temporary_audio) * volume_factor;
+  }
+
+  audio operator*(const std::pair<float, float>& volume_factor) &&{
+    *this *= volume_factor;
+    return std::move(*this);
+  }
+
+  audio& operator+=(const audio& rhs){
+    std::size_t length = std::min(this->stereo.size(), rhs.stereo.size());
+    T* samples = channels(this->stereo);
+    const T* other = channels(rhs.stereo);
+    audio_parallel::for_each_chunk<T>(2 * length, [&](std::size_t begin, std::size_t end){
+      audio_kernels::saturating_add(samples + begin, other + begin, samples + begin, end - begin);
+    });
+    return *this;
+  }
+
+  audio operator+(const audio& rhs) const&{
+    audio temporary_audio = *this;
+    return std::move(temporary_audio) + rhs;
+  }
+
+  audio operator+(const audio& rhs) &&{
+    *this += rhs;
+    return std::move(*this);
+  }
+
+  audio& operator^=(const std::pair<int, int>& range){
+    std::pair<std::size_t, std::size_t> cut = clamp_range(range, stereo.size());
+    std::size_t first = cut.first, last = cut.second;
+    if(first < last){
+      stereo.erase(stereo.begin() + first, stereo.begin() + last);
     }
+    return *this;
+  }
+
+  audio operator^(const std::pair<int, int>& range) const&{
+    audio temporary_audio(buffer_type(stereo.get_allocator()), sample_length);
+    std::pair<std::size_t, std::size_t> cut = clamp_range(range, stereo.size());
+    std::size_t first = cut.first, last = cut.second;
+    temporary_audio.stereo.reserve(stereo.size() - (last - first));
+    temporary_audio.stereo.insert(temporary_audio.stereo.end(), stereo.begin(), stereo.begin() + first);
+    temporary_audio.stereo.insert(temporary_audio.stereo.end(), stereo.begin() + last, stereo.end());
     return temporary_audio;
   }
 
+  audio operator^(const std::pair<int, int>& range) &&{
+    *this ^= range;
+    return std::move(*this);
+  }
+
   void reverse (){
    std::reverse(stereo.begin(), stereo.end());
   }
 
-  audio<std::pair<T, T>> ranged_add(const std::pair<int, int>& range1, const std::pair<int, int>& range2, const audio<std::pair<T, T>>& rhs){
-    auto temporary_audio = *this;
-    auto temporary_rhs = rhs;
-    audio<std::pair<T, T>> result;
-    temporary_rhs.stereo = temporary_audio.stereo = std::vector<std::pair<T, T>>(range1.second - range1.first + 1);
-    std::copy(this->stereo.begin() + range1.first, this->stereo.begin() + range1.second + 1, temporary_audio.stereo.begin());
-    std::copy(rhs.stereo.begin() + range2.first, rhs.stereo.begin() + range2.second + 1, temporary_rhs.stereo.begin());
+  audio_view<std::pair<T, T>> view() const{
+    return audio_view<std::pair<T, T>>(this->stereo.data(), this->stereo.size(), sample_length);
+  }
 
-    result = temporary_audio + temporary_rhs;
+  audio_view<std::pair<T, T>> view(const std::pair<int, int>& range) const{
+    return view().subview(range);
+  }
+
+  audio ranged_add(const std::pair<int, int>& range1, const std::pair<int, int>& range2, const audio& rhs) const{
+    audio_view<std::pair<T, T>> lhs = view(range1), other = rhs.view(range2);
+    audio result(buffer_type(std::min(lhs.size(), other.size()), std::pair<T, T>(), stereo.get_allocator()), sample_length);
+    lhs.add(other, result.stereo.data());
     return result;
   }
 
-  std::pair<float, float> calculate_rms(){
-    int init = 0;
-    float rms1, rms2;
-    rms1 = std::accumulate(this->stereo.begin(),
-                                this->stereo.end(),
-                                init, [&](T accumulated_sum, std::pair<T, T> x){return(accumulated_sum + pow(x.first, 2.0));});
-    rms1 = (float)sqrt(rms1 / this->stereo.size());
+  std::pair<float, float> calculate_rms() const{
+    return view().calculate_rms();
+  }
+
+  // per channel rms of the frames in the inclusive range, in one pass
+  std::pair<float, float> calculate_rms(const std::pair<int, int>& range) const{
+    return view(range).calculate_rms();
+  }
+
+  // silent channels keep a gain of one, as in normalize_gains
+  void normalize_in_place(std::pair<float, float> rms_pair, float desired_rms){
+    scale(rms_pair.first > 0 ? desired_rms / rms_pair.first : 1, rms_pair.second > 0 ? desired_rms / rms_pair.second : 1);
+  }
+
+  audio normalize(std::pair<float, float> rms_pair, float desired_rms) const&{
+    audio temporary_audio = *this;
+    return std::move(temporary_audio).normalize(rms_pair, desired_rms);
+  }
+
+  audio normalize(std::pair<float, float> rms_pair, float desired_rms) &&{
+    normalize_in_place(rms_pair, desired_rms);
+    return std::move(*this);
+  }
+
+  // scales the clip so that its rms or peak becomes target, with one read
+  // pass to measure and one in-place pass to apply the gain, which saturates
+  void normalize_to_in_place(float target, level_measure measure = level_measure::rms, bool linked = false){
+    *this *= view().normalize_gains(target, measure, linked);
+  }
+
+  audio normalize_to(float target, level_measure measure = level_measure::rms, bool linked = false) const&{
+    audio temporary_audio = *this;
+    return std::move(temporary_audio).normalize_to(target, measure, linked);
+  }
+
+  audio normalize_to(float target, level_measure measure = level_measure::rms, bool linked = false) &&{
+    normalize_to_in_place(target, measure, linked);
+    return std::move(*this);
+  }
+
+  // applies ramp to the frames it covers; positions are frame indices
+  void apply_envelope(const audio_kernels::envelope& ramp){
+    audio_kernels::apply_envelope(channels(stereo), stereo.size(), 2, ramp);
+  }
+
+  void fade_in_in_place(float number_of_seconds, fade_curve curve = fade_curve::linear){
+    audio_kernels::envelope ramp = {0, ramp_frames(number_of_seconds), 0, 1, curve};
+    audio_kernels::apply_envelope(channels(stereo), stereo.size(), 2, ramp);
+  }
+
+  audio fade_in(float number_of_seconds, fade_curve curve = fade_curve::linear) const&{
+    audio temporary_audio = *this;
+    return std::move(temporary_audio).fade_in(number_of_seconds, curve);
+  }
+
+  audio fade_in(float number_of_seconds, fade_curve curve = fade_curve::linear) &&{
+    fade_in_in_place(number_of_seconds, curve);
+    return std::move(*this);
+  }
+
+  // the ramp finishes on the last frame, even when it is longer than the clip
+  void fade_out_in_place(float number_of_seconds, fade_curve curve = fade_curve::linear){
+    std::size_t length = ramp_frames(number_of_seconds), end = std::max(length, stereo.size());
+    audio_kernels::envelope ramp = {end - length, length, 1, 0, curve};
+    audio_kernels::apply_envelope(channels(stereo), stereo.size(), 2, ramp, end - stereo.size());
+  }
+
+  audio fade_out(float number_of_seconds, fade_curve curve = fade_curve::linear) const&{
+    audio temporary_audio = *this;
+    return std::move(temporary_audio).fade_out(number_of_seconds, curve);
+  }
+
+  audio fade_out(float number_of_seconds, fade_curve curve = fade_curve::linear) &&{
+    fade_out_in_place(number_of_seconds, curve);
+    return std::move(*this);
+  }
+
+};
+
+// Interleaved clips of N channels, such as 5.1 or 7.1 stems, with
+// std::array<T, N> frames. Gains and rms values are one float per channel;
+// per channel loops have N as their bound and are unrolled by the compiler.
+template<typename T, std::size_t N, typename Alloc>
+class audio<std::array<T, N>, Alloc>{
+public:
+  typedef std::array<T, N> frame;
+  typedef std::vector<frame, Alloc> buffer_type;
+  typedef std::array<float, N> gain_type;
 
-    rms2 = std::accumulate(this->stereo.begin(),
-                                this->stereo.end(),
-                                init, [&](T accumulated_sum, std::pair<T, T> x){return(accumulated_sum + pow(x.second, 2.0));});
+private:
+  buffer_type frames;
+  int sample_length;
 
-    rms2 = (float)sqrt(rms2 / this->stereo.size());
+  static_assert(sizeof(frame) == N * sizeof(T), "frames must be N packed samples");
 
-    std::pair<float, float> rms_pair = {rms1, rms2};
-    return rms_pair;
+  static T* channels(buffer_type& buffer){
+    return reinterpret_cast<T*>(buffer.data());
   }
 
-  audio<std::pair<T, T>> normalize(std::pair<float, float> rms_pair, float desired_rms){
-    auto temporary_audio = *this;
+  friend struct audio_expr::clip<frame>;
+
+  std::size_t ramp_frames(float number_of_seconds) const{
+    return number_of_seconds > 0 ? (std::size_t)std::lround(number_of_seconds * sample_length) : 0;
+  }
+
+  void scale(const gain_type& gains){
+    T* samples = channels(frames);
+    audio_parallel::for_each_chunk<T>(N * frames.size(), [&](std::size_t begin, std::size_t end){
+      audio_kernels::apply_channel_gains(samples + begin, end - begin, N, gains.data(), begin);
+    });
+  }
+public:
+  audio(size_t dim = 0) : frames(dim), sample_length(0){}
 
-    std::transform(this->stereo.begin(),
-                   this->stereo.end(),
-                   temporary_audio.stereo.begin(),
-                   [&](std::pair<T, T> x){return (x.first *= (desired_rms / rms_pair.first));}
-                 );
+  audio(buffer_type lst) : frames(std::move(lst)), sample_length(0){}
 
-   std::transform(this->stereo.begin(),
-                  this->stereo.end(),
-                  temporary_audio.stereo.begin(),
-                  [&](std::pair<T, T> x){return (x.second *= (desired_rms / rms_pair.second));}
-                );
+  audio(buffer_type lst, int sampl_len) : frames(std::move(lst)), sample_length(sampl_len){}
+
+  template<typename E>
+  audio(const audio_expr::expression<E>& expr) : frames(expr.self().size()), sample_length(expr.self().sample_length){
+    audio_expr::evaluate(expr, channels(frames));
+  }
+
+  template<typename E>
+  audio& operator=(const audio_expr::expression<E>& expr){
+    frames.resize(expr.self().size());
+    sample_length = expr.self().sample_length;
+    audio_expr::evaluate(expr, channels(frames));
+    return *this;
+  }
+
+  virtual ~audio() = default;
+
+  audio(const audio& rhs) = default;
+
+  audio& operator=(const audio& rhs) = default;
+
+  audio(audio&& rhs) : frames(std::move(rhs.frames)), sample_length(rhs.sample_length){}
+
+  audio& operator=(audio&& rhs){
+    if (this != &rhs){
+      this->frames = move(rhs.frames);
+      this->sample_length = rhs.sample_length;
+    }
+    return *this;
+  }
+
+  int get_sample_length() const{
+    return sample_length;
+  }
+
+  frame& operator[] (std::size_t index){
+    return frames[index];
+  }
+
+  const frame& operator[] (std::size_t index) const{
+    return frames[index];
+  }
+
+  const buffer_type& get_buffer() const{
+    return frames;
+  }
+
+  const frame* data() const{
+    return frames.data();
+  }
+
+  std::size_t size() const{
+    return frames.size();
+  }
+
+  typename buffer_type::const_iterator begin() const{
+    return frames.begin();
+  }
 
+  typename buffer_type::const_iterator end() const{
+    return frames.end();
+  }
+
+  audio& operator|=(const audio& rhs){
+    if(&rhs == this){
+      audio copy = rhs;
+      return *this |= copy;
+    }
+    frames.insert(frames.end(), rhs.frames.begin(), rhs.frames.end());
+    return *this;
+  }
+
+  audio operator|(const audio& rhs) const&{
+    audio temporary_audio(buffer_type(frames.get_allocator()), sample_length);
+    temporary_audio.frames.reserve(this->frames.size() + rhs.frames.size());
+    temporary_audio.frames.insert(temporary_audio.frames.end(), this->frames.begin(), this->frames.end());
+    temporary_audio.frames.insert(temporary_audio.frames.end(), rhs.frames.begin(), rhs.frames.end());
     return temporary_audio;
   }
 
-  audio<std::pair<T, T>> fade_in(int number_of_seconds){
-    int fade_sample_no = 1;
-    float ramp_length = number_of_seconds * sample_length;
-    auto temporary_audio = *this;
-
-    std::for_each(temporary_audio.stereo.begin(),
-                  temporary_audio.stereo.end(),
-                  [&fade_sample_no, ramp_length](std::pair<T, T> x){
-                    while(fade_sample_no < ramp_length){
-                      x.first = (fade_sample_no / ramp_length) * x.first;
-                      x.second = (fade_sample_no / ramp_length) * x.second;
-                      ++fade_sample_no;
-                    }
-                  }
-                );
+  audio operator|(const audio& rhs) &&{
+    *this |= rhs;
+    return std::move(*this);
+  }
+
+  // rhs joined on after an equal-power crossfade of overlap frames, instead
+  // of the butt join of operator|
+  audio crossfade(const audio& rhs, std::size_t overlap) const{
+    audio temporary_audio(buffer_type(frames.get_allocator()), sample_length);
+    view().crossfade_into(rhs.view(), overlap, temporary_audio.frames);
     return temporary_audio;
   }
 
-  audio<std::pair<T, T>> fade_out(int number_of_seconds){
-    int fade_sample_no = 1;
-    float ramp_length = number_of_seconds * sample_length;
-    auto temporary_audio = *this;
-
-    std::for_each(temporary_audio.stereo.begin(),
-                  temporary_audio.stereo.end(),
-                  [&fade_sample_no, ramp_length](std::pair<T, T> x){
-                    while(fade_sample_no < ramp_length){
-                      x.first = (1 - fade_sample_no / ramp_length) * x.first;
-                      x.second = (1 - fade_sample_no / ramp_length) * x.second;
-                      ++fade_sample_no;
-                    }
-                  }
-                );
+  audio& operator*=(const gain_type& volume_factor){
+    scale(volume_factor);
+    return *this;
+  }
+
+  audio operator*(const gain_type& volume_factor) const&{
+    audio temporary_audio = *this;
+    return std::move(temporary_audio) * volume_factor;
+  }
+
+  audio operator*(const gain_type& volume_factor) &&{
+    *this *= volume_factor;
+    return std::move(*this);
+  }
+
+  audio& operator+=(const audio& rhs){
+    std::size_t length = std::min(this->frames.size(), rhs.frames.size());
+    T* samples = channels(this->frames);
+    const T* other = reinterpret_cast<const T*>(rhs.frames.data());
+    audio_parallel::for_each_chunk<T>(N * length, [&](std::size_t begin, std::size_t end){
+      audio_kernels::saturating_add(samples + begin, other + begin, samples + begin, end - begin);
+    });
+    return *this;
+  }
+
+  audio operator+(const audio& rhs) const&{
+    audio temporary_audio = *this;
+    return std::move(temporary_audio) + rhs;
+  }
+
+  audio operator+(const audio& rhs) &&{
+    *this += rhs;
+    return std::move(*this);
+  }
+
+  audio& operator^=(const std::pair<int, int>& range){
+    std::pair<std::size_t, std::size_t> cut = clamp_range(range, frames.size());
+    std::size_t first = cut.first, last = cut.second;
+    if(first < last){
+      frames.erase(frames.begin() + first, frames.begin() + last);
+    }
+    return *this;
+  }
+
+  audio operator^(const std::pair<int, int>& range) const&{
+    audio temporary_audio(buffer_type(frames.get_allocator()), sample_length);
+    std::pair<std::size_t, std::size_t> cut = clamp_range(range, frames.size());
+    std::size_t first = cut.first, last = cut.second;
+    temporary_audio.frames.reserve(frames.size() - (last - first));
+    temporary_audio.frames.insert(temporary_audio.frames.end(), frames.begin(), frames.begin() + first);
+    temporary_audio.frames.insert(temporary_audio.frames.end(), frames.begin() + last, frames.end());
     return temporary_audio;
   }
 
+  audio operator^(const std::pair<int, int>& range) &&{
+    *this ^= range;
+    return std::move(*this);
+  }
+
+  void reverse(){
+    std::reverse(frames.begin(), frames.end());
+  }
+
+  audio_view<frame> view() const{
+    return audio_view<frame>(this->frames.data(), this->frames.size(), sample_length);
+  }
+
+  audio_view<frame> view(const std::pair<int, int>& range) const{
+    return view().subview(range);
+  }
+
+  audio ranged_add(const std::pair<int, int>& range1, const std::pair<int, int>& range2, const audio& rhs) const{
+    audio_view<frame> lhs = view(range1), other = rhs.view(range2);
+    audio result(buffer_type(std::min(lhs.size(), other.size()), frame(), frames.get_allocator()), sample_length);
+    lhs.add(other, result.frames.data());
+    return result;
+  }
+
+  gain_type calculate_rms() const{
+    return view().calculate_rms();
+  }
+
+  // per channel rms of the frames in the inclusive range, in one pass
+  gain_type calculate_rms(const std::pair<int, int>& range) const{
+    return view(range).calculate_rms();
+  }
+
+  // silent channels keep a gain of one, as in normalize_gains
+  void normalize_in_place(const gain_type& rms, float desired_rms){
+    gain_type gains;
+    for(std::size_t c = 0; c < N; ++c){
+      gains[c] = rms[c] > 0 ? desired_rms / rms[c] : 1;
+    }
+    scale(gains);
+  }
+
+  audio normalize(const gain_type& rms, float desired_rms) const&{
+    audio temporary_audio = *this;
+    return std::move(temporary_audio).normalize(rms, desired_rms);
+  }
+
+  audio normalize(const gain_type& rms, float desired_rms) &&{
+    normalize_in_place(rms, desired_rms);
+    return std::move(*this);
+  }
+
+  // scales the clip so that its rms or peak becomes target, with one read
+  // pass to measure and one in-place pass to apply the gain, which saturates
+  void normalize_to_in_place(float target, level_measure measure = level_measure::rms, bool linked = false){
+    *this *= view().normalize_gains(target, measure, linked);
+  }
+
+  audio normalize_to(float target, level_measure measure = level_measure::rms, bool linked = false) const&{
+    audio temporary_audio = *this;
+    return std::move(temporary_audio).normalize_to(target, measure, linked);
+  }
+
+  audio normalize_to(float target, level_measure measure = level_measure::rms, bool linked = false) &&{
+    normalize_to_in_place(target, measure, linked);
+    return std::move(*this);
+  }
+
+  // applies ramp to the frames it covers; positions are frame indices
+  void apply_envelope(const audio_kernels::envelope& ramp){
+    audio_kernels::apply_envelope(channels(frames), frames.size(), N, ramp);
+  }
+
+  void fade_in_in_place(float number_of_seconds, fade_curve curve = fade_curve::linear){
+    audio_kernels::envelope ramp = {0, ramp_frames(number_of_seconds), 0, 1, curve};
+    audio_kernels::apply_envelope(channels(frames), frames.size(), N, ramp);
+  }
+
+  audio fade_in(float number_of_seconds, fade_curve curve = fade_curve::linear) const&{
+    audio temporary_audio = *this;
+    return std::move(temporary_audio).fade_in(number_of_seconds, curve);
+  }
+
+  audio fade_in(float number_of_seconds, fade_curve curve = fade_curve::linear) &&{
+    fade_in_in_place(number_of_seconds, curve);
+    return std::move(*this);
+  }
+
+  // the ramp finishes on the last frame, even when it is longer than the clip
+  void fade_out_in_place(float number_of_seconds, fade_curve curve = fade_curve::linear){
+    std::size_t length = ramp_frames(number_of_seconds), end = std::max(length, frames.size());
+    audio_kernels::envelope ramp = {end - length, length, 1, 0, curve};
+    audio_kernels::apply_envelope(channels(frames), frames.size(), N, ramp, end - frames.size());
+  }
+
+  audio fade_out(float number_of_seconds, fade_curve curve = fade_curve::linear) const&{
+    audio temporary_audio = *this;
+    return std::move(temporary_audio).fade_out(number_of_seconds, curve);
+  }
+
+  audio fade_out(float number_of_seconds, fade_curve curve = fade_curve::linear) &&{
+    fade_out_in_place(number_of_seconds, curve);
+    return std::move(*this);
+  }
+};
+
+// A non-owning window onto the frames of a clip, or of any other contiguous
+// frame buffer. T is the frame type. Operations read the window in place
+// and allocate only the clip they return.
+template<typename T>
+class audio_view{
+private:
+  typedef typename audio_kernels::frame_traits<T>::sample sample;
+  static const int channels = audio_kernels::frame_traits<T>::channels;
+
+  const T* frames;
+  std::size_t length;
+  int sample_length;
+
+  static const int slots = channels > 2 ? channels : 2;
+  typedef audio_kernels::channel_sums<typename audio_kernels::square_accumulator<sample>::type, slots> sums;
+  typedef audio_kernels::channel_peaks<typename audio_kernels::sample_traits<sample>::accumulator, slots> peaks;
+
+  const sample* samples() const{
+    return reinterpret_cast<const sample*>(frames);
+  }
+
+  // the rms or peak of every channel in one parallel read pass; unused
+  // slots are left at zero
+  void levels(level_measure measure, double* values) const{
+    const sample* in = samples();
+    std::fill(values, values + slots, 0.0);
+    if(measure == level_measure::peak){
+      peaks total = audio_parallel::chunked_sum<T, peaks>(length, [&](std::size_t begin, std::size_t end){
+        peaks partial;
+        audio_kernels::frame_peaks<channels>(in + begin * channels, end - begin, partial.peak);
+        return partial;
+      });
+      for(int c = 0; c < channels; ++c){
+        values[c] = (double)total.peak[c];
+      }
+      return;
+    }
+    sums total = audio_parallel::chunked_sum<T, sums>(length, [&](std::size_t begin, std::size_t end){
+      sums partial;
+      audio_kernels::frame_sum_of_squares<channels>(in + begin * channels, end - begin, partial.sum);
+      return partial;
+    });
+    for(int c = 0; c < channels && length != 0; ++c){
+      values[c] = sqrt((double)total.sum[c] / length);
+    }
+  }
+
+  static void to_levels(const double* values, float& result){
+    result = (float)values[0];
+  }
+
+  static void to_levels(const double* values, std::pair<float, float>& result){
+    result = std::make_pair((float)values[0], (float)values[1]);
+  }
+
+  template<std::size_t N>
+  static void to_levels(const double* values, std::array<float, N>& result){
+    for(std::size_t c = 0; c < N; ++c){
+      result[c] = (float)values[c];
+    }
+  }
+
+  static void gain_values(const std::pair<float, float>& volume_factor, float* gain){
+    gain[0] = volume_factor.first;
+    gain[1] = volume_factor.second;
+  }
+
+  template<std::size_t N>
+  static void gain_values(const std::array<float, N>& volume_factor, float* gain){
+    std::copy(volume_factor.begin(), volume_factor.end(), gain);
+  }
+
+public:
+  typedef typename audio_kernels::frame_traits<T>::levels rms_type;
+  typedef typename audio_kernels::frame_traits<T>::gains gain_type;
+
+  audio_view() : frames(nullptr), length(0), sample_length(0){}
+
+  audio_view(const T* first, std::size_t size, int sampl_len) : frames(first), length(size), sample_length(sampl_len){}
+
+  const T* data() const{
+    return frames;
+  }
+
+  std::size_t size() const{
+    return length;
+  }
+
+  const T& operator[](std::size_t index) const{
+    return frames[index];
+  }
+
+  const T* begin() const{
+    return frames;
+  }
+
+  const T* end() const{
+    return frames + length;
+  }
+
+  int get_sample_length() const{
+    return sample_length;
+  }
+
+  // the inclusive range, clamped to the view
+  audio_view subview(const std::pair<int, int>& range) const{
+    std::pair<std::size_t, std::size_t> span = clamp_range(range, length);
+    return audio_view(frames + span.first, span.second - span.first, sample_length);
+  }
+
+  audio<T> to_audio() const{
+    return audio<T>(std::vector<T>(begin(), end()), sample_length);
+  }
+
+  // writes the saturated sum of the overlapping frames to result
+  void add(const audio_view& rhs, T* result) const{
+    std::size_t count = std::min(length, rhs.length);
+    sample* out = reinterpret_cast<sample*>(result);
+    const sample* lhs_samples = samples();
+    const sample* rhs_samples = rhs.samples();
+    audio_parallel::for_each_chunk<sample>(count * channels, [&](std::size_t begin, std::size_t end){
+      audio_kernels::saturating_add(lhs_samples + begin, rhs_samples + begin, out + begin, end - begin);
+    });
+  }
+
+  audio<T> operator+(const audio_view& rhs) const{
+    std::vector<T> result(std::min(length, rhs.length));
+    add(rhs, result.data());
+    return audio<T>(std::move(result), sample_length);
+  }
+
+  // Appends this view joined to rhs by an equal-power crossfade over the
+  // last overlap frames of one and the first of the other, reserving the
+  // output once and appending the overlap a tile at a time.
+  template<typename Buffer>
+  void crossfade_into(const audio_view& rhs, std::size_t overlap, Buffer& result) const{
+    overlap = std::min(overlap, std::min(length, rhs.length));
+    result.reserve(result.size() + length + rhs.length - overlap);
+    result.insert(result.end(), frames, frames + length - overlap);
+    const std::size_t tile = 256;
+    T mixed[tile];
+    for(std::size_t done = 0; done < overlap; done += tile){
+      std::size_t count = std::min(tile, overlap - done);
+      const T* from = frames + length - overlap + done;
+      audio_kernels::crossfade(reinterpret_cast<const sample*>(from), reinterpret_cast<const sample*>(rhs.frames + done),
+                               reinterpret_cast<sample*>(mixed), count, channels, done, overlap);
+      result.insert(result.end(), mixed, mixed + count);
+    }
+    result.insert(result.end(), rhs.frames + overlap, rhs.frames + rhs.length);
+  }
+
+  audio<T> crossfade(const audio_view& rhs, std::size_t overlap) const{
+    std::vector<T> result;
+    crossfade_into(rhs, overlap, result);
+    return audio<T>(std::move(result), sample_length);
+  }
+
+  audio<T> operator*(const gain_type& volume_factor) const{
+    std::vector<T> result(length);
+    sample* out = reinterpret_cast<sample*>(result.data());
+    const sample* in = samples();
+    float gain[channels > 2 ? channels : 2];
+    gain_values(volume_factor, gain);
+    audio_parallel::for_each_chunk<sample>(length * channels, [&](std::size_t begin, std::size_t end){
+      std::copy(in + begin, in + end, out + begin);
+      audio_kernels::apply_channel_gains(out + begin, end - begin, channels, gain, begin);
+    });
+    return audio<T>(std::move(result), sample_length);
+  }
+
+  rms_type calculate_rms() const{
+    double values[slots];
+    levels(level_measure::rms, values);
+    rms_type rms;
+    to_levels(values, rms);
+    return rms;
+  }
+
+  rms_type calculate_peak() const{
+    double values[slots];
+    levels(level_measure::peak, values);
+    rms_type peak;
+    to_levels(values, peak);
+    return peak;
+  }
+
+  // Gains that bring every channel to target. Linked channels share one
+  // gain, set by the loudest peak or by their combined power, so the stereo
+  // image is kept; silent channels keep a gain of one.
+  gain_type normalize_gains(float target, level_measure measure = level_measure::rms, bool linked = false) const{
+    double values[slots];
+    levels(measure, values);
+    if(linked){
+      double combined = 0;
+      for(int c = 0; c < channels; ++c){
+        combined = measure == level_measure::peak ? std::max(combined, values[c]) : combined + values[c] * values[c];
+      }
+      if(measure == level_measure::rms){
+        combined = sqrt(combined / channels);
+      }
+      std::fill(values, values + channels, combined);
+    }
+    double gains[slots];
+    for(int c = 0; c < slots; ++c){
+      gains[c] = values[c] > 0 ? target / values[c] : 1;
+    }
+    gain_type result;
+    to_levels(gains, result);
+    return result;
+  }
+
+  audio<T> fade_in(float number_of_seconds, fade_curve curve = fade_curve::linear) const{
+    return to_audio().fade_in(number_of_seconds, curve);
+  }
+
+  audio<T> fade_out(float number_of_seconds, fade_curve curve = fade_curve::linear) const{
+    return to_audio().fade_out(number_of_seconds, curve);
+  }
+};
+
+// stereo stored as one contiguous buffer per channel; every operation runs
+// the mono kernels on each channel and interleaving only happens when
+// converting to or from audio<std::pair<T, T>>. Each channel is an
+// audio<T, Alloc>, cache line aligned by default like aligned_audio<T>.
+// Only stereo has a planar form; clips of std::array<T, N> frames stay
+// interleaved.
+template<typename T, typename Alloc>
+class planar_audio{
+public:
+  typedef audio<T, Alloc> channel_type;
+  typedef typename channel_type::buffer_type buffer_type;
+
+private:
+  channel_type left;
+  channel_type right;
+  int sample_length;
+public:
+  planar_audio(size_t dim = 0) : left(dim), right(dim), sample_length(0){}
+
+  template<typename A>
+  planar_audio(const audio<T, A>& left_channel, const audio<T, A>& right_channel, int sampl_len)
+    : left(buffer_type(left_channel.begin(), left_channel.end()), sampl_len),
+      right(buffer_type(right_channel.begin(), right_channel.end()), sampl_len), sample_length(sampl_len){}
+
+  template<typename A>
+  planar_audio(const audio<std::pair<T, T>, A>& interleaved) : sample_length(interleaved.get_sample_length()){
+    const typename audio<std::pair<T, T>, A>::buffer_type& frames = interleaved.get_buffer();
+    buffer_type left_samples(frames.size()), right_samples(frames.size());
+    for(std::size_t i = 0; i < frames.size(); ++i){
+      left_samples[i] = frames[i].first;
+      right_samples[i] = frames[i].second;
+    }
+    left = channel_type(std::move(left_samples), sample_length);
+    right = channel_type(std::move(right_samples), sample_length);
+  }
+
+  audio<std::pair<T, T>> interleave() const{
+    const buffer_type& left_samples = left.get_buffer();
+    const buffer_type& right_samples = right.get_buffer();
+    std::vector<std::pair<T, T>> frames(left_samples.size());
+    for(std::size_t i = 0; i < frames.size(); ++i){
+      frames[i] = std::make_pair(left_samples[i], right_samples[i]);
+    }
+    return audio<std::pair<T, T>>(std::move(frames), sample_length);
+  }
+
+  const channel_type& left_channel() const{
+    return left;
+  }
+
+  const channel_type& right_channel() const{
+    return right;
+  }
+
+  int get_sample_length() const{
+    return sample_length;
+  }
+
+  planar_audio& operator|=(const planar_audio& rhs){
+    left |= rhs.left;
+    right |= rhs.right;
+    return *this;
+  }
+
+  planar_audio& operator*=(const std::pair<float, float>& volume_factor){
+    left *= std::make_pair(volume_factor.first, volume_factor.first);
+    right *= std::make_pair(volume_factor.second, volume_factor.second);
+    return *this;
+  }
+
+  planar_audio& operator+=(const planar_audio& rhs){
+    left += rhs.left;
+    right += rhs.right;
+    return *this;
+  }
+
+  planar_audio& operator^=(const std::pair<int, int>& range){
+    left ^= range;
+    right ^= range;
+    return *this;
+  }
+
+  void normalize_in_place(std::pair<float, float> rms_pair, float desired_rms){
+    left.normalize_in_place(rms_pair.first, desired_rms);
+    right.normalize_in_place(rms_pair.second, desired_rms);
+  }
+
+  void apply_envelope(const audio_kernels::envelope& ramp){
+    left.apply_envelope(ramp);
+    right.apply_envelope(ramp);
+  }
+
+  void fade_in_in_place(float number_of_seconds, fade_curve curve = fade_curve::linear){
+    left.fade_in_in_place(number_of_seconds, curve);
+    right.fade_in_in_place(number_of_seconds, curve);
+  }
+
+  void fade_out_in_place(float number_of_seconds, fade_curve curve = fade_curve::linear){
+    left.fade_out_in_place(number_of_seconds, curve);
+    right.fade_out_in_place(number_of_seconds, curve);
+  }
+
+  planar_audio operator|(const planar_audio& rhs) const{
+    planar_audio result;
+    result.left = left | rhs.left;
+    result.right = right | rhs.right;
+    result.sample_length = sample_length;
+    return result;
+  }
+
+  planar_audio operator*(const std::pair<float, float>& volume_factor) const{
+    planar_audio result;
+    result.left = left * std::make_pair(volume_factor.first, volume_factor.first);
+    result.right = right * std::make_pair(volume_factor.second, volume_factor.second);
+    result.sample_length = sample_length;
+    return result;
+  }
+
+  planar_audio operator+(const planar_audio& rhs) const{
+    planar_audio result;
+    result.left = left + rhs.left;
+    result.right = right + rhs.right;
+    result.sample_length = sample_length;
+    return result;
+  }
+
+  planar_audio operator^(const std::pair<int, int>& range) const{
+    planar_audio result;
+    result.left = left ^ range;
+    result.right = right ^ range;
+    result.sample_length = sample_length;
+    return result;
+  }
+
+  void reverse(){
+    left.reverse();
+    right.reverse();
+  }
+
+  planar_audio ranged_add(const std::pair<int, int>& range1, const std::pair<int, int>& range2, const planar_audio& rhs) const{
+    planar_audio result;
+    result.left = left.ranged_add(range1, range2, rhs.left);
+    result.right = right.ranged_add(range1, range2, rhs.right);
+    result.sample_length = sample_length;
+    return result;
+  }
+
+  std::pair<float, float> calculate_rms() const{
+    return std::make_pair(left.calculate_rms(), right.calculate_rms());
+  }
+
+  std::pair<float, float> calculate_rms(const std::pair<int, int>& range) const{
+    return std::make_pair(left.calculate_rms(range), right.calculate_rms(range));
+  }
+
+  planar_audio normalize(std::pair<float, float> rms_pair, float desired_rms) const{
+    planar_audio result;
+    result.left = left.normalize(rms_pair.first, desired_rms);
+    result.right = right.normalize(rms_pair.second, desired_rms);
+    result.sample_length = sample_length;
+    return result;
+  }
+
+  planar_audio fade_in(float number_of_seconds, fade_curve curve = fade_curve::linear) const{
+    planar_audio result;
+    result.left = left.fade_in(number_of_seconds, curve);
+    result.right = right.fade_in(number_of_seconds, curve);
+    result.sample_length = sample_length;
+    return result;
+  }
+
+  planar_audio fade_out(float number_of_seconds, fade_curve curve = fade_curve::linear) const{
+    planar_audio result;
+    result.left = left.fade_out(number_of_seconds, curve);
+    result.right = right.fade_out(number_of_seconds, curve);
+    result.sample_length = sample_length;
+    return result;
+  }
 };
 
 #endif
@@ -0,0 +1,11 @@
+#ifndef AUDIO_ALIGNED_H
+#define AUDIO_ALIGNED_H
+
+#include "audio.h"
+#include "audio_memory.h"
+
+// mono or stereo clip with cache line aligned storage
+template<typename T>
+using aligned_audio = audio<T, aligned_allocator<T>>;
+
+#endif
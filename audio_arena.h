@@ -0,0 +1,166 @@
+#ifndef AUDIO_ARENA_H
+#define AUDIO_ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+#include "audio_aligned.h"
+
+// A bump region for the temporaries of one job. Allocations carve blocks
+// front to back, deallocation only gives back the most recent allocation,
+// and reset() recycles every block at once without touching the heap.
+// Every allocation starts on a cache line, like aligned_allocator.
+// Clips allocated from an arena must not be used after its next reset().
+// An arena is not thread safe; give each job thread its own.
+class audio_arena{
+private:
+  struct release{
+    void operator()(char* memory) const{
+      audio_memory::deallocate(memory);
+    }
+  };
+
+  struct block{
+    std::unique_ptr<char, release> memory;
+    std::size_t size;
+  };
+
+  std::vector<block> blocks;
+  std::size_t current;
+  std::size_t used;
+  std::size_t block_bytes;
+
+  static std::size_t round_up(std::size_t bytes){
+    return (bytes + audio_memory::cache_line - 1) / audio_memory::cache_line * audio_memory::cache_line;
+  }
+
+  static audio_arena*& active(){
+    static thread_local audio_arena* arena = nullptr;
+    return arena;
+  }
+
+public:
+  // makes arena the one default constructed arena_allocators use on this
+  // thread until the scope ends
+  class scope{
+  private:
+    audio_arena* previous;
+  public:
+    explicit scope(audio_arena& arena) : previous(active()){
+      active() = &arena;
+    }
+
+    ~scope(){
+      active() = previous;
+    }
+
+    scope(const scope& rhs) = delete;
+
+    scope& operator=(const scope& rhs) = delete;
+  };
+
+  explicit audio_arena(std::size_t block_size = 1 << 24) : current(0), used(0), block_bytes(round_up(block_size)){}
+
+  audio_arena(const audio_arena& rhs) = delete;
+
+  audio_arena& operator=(const audio_arena& rhs) = delete;
+
+  static audio_arena* current_arena(){
+    return active();
+  }
+
+  void* allocate(std::size_t bytes){
+    bytes = round_up(std::max<std::size_t>(bytes, 1));
+    while(current < blocks.size() && blocks[current].size - used < bytes){
+      ++current;
+      used = 0;
+    }
+    if(current == blocks.size()){
+      std::size_t size = std::max(bytes, block_bytes);
+      block fresh = {std::unique_ptr<char, release>(static_cast<char*>(audio_memory::allocate(size))), size};
+      blocks.push_back(std::move(fresh));
+      used = 0;
+    }
+    void* memory = blocks[current].memory.get() + used;
+    used += bytes;
+    return memory;
+  }
+
+  void deallocate(void* memory, std::size_t bytes){
+    bytes = round_up(std::max<std::size_t>(bytes, 1));
+    if(current < blocks.size() && static_cast<char*>(memory) + bytes == blocks[current].memory.get() + used){
+      used -= bytes;
+    }
+  }
+
+  // frees everything allocated so far in O(1); the blocks are kept for reuse
+  void reset(){
+    current = 0;
+    used = 0;
+  }
+
+  std::size_t capacity() const{
+    std::size_t total = 0;
+    for(const block& b : blocks){
+      total += b.size;
+    }
+    return total;
+  }
+};
+
+// Allocator for audio<T, arena_allocator<T>>. A default constructed one
+// draws from the arena of the enclosing audio_arena::scope, or from the
+// heap when there is none, so every temporary an operator creates lands in
+// the job's arena without passing it around.
+template<typename T>
+class arena_allocator{
+private:
+  template<typename U>
+  friend class arena_allocator;
+
+  audio_arena* arena;
+
+public:
+  typedef T value_type;
+  typedef std::true_type propagate_on_container_move_assignment;
+  typedef std::true_type propagate_on_container_swap;
+
+  arena_allocator() : arena(audio_arena::current_arena()){}
+
+  explicit arena_allocator(audio_arena& source) : arena(&source){}
+
+  template<typename U>
+  arena_allocator(const arena_allocator<U>& rhs) : arena(rhs.arena){}
+
+  T* allocate(std::size_t count){
+    if(arena == nullptr){
+      return static_cast<T*>(audio_memory::allocate(count * sizeof(T)));
+    }
+    return static_cast<T*>(arena->allocate(count * sizeof(T)));
+  }
+
+  void deallocate(T* memory, std::size_t count){
+    if(arena == nullptr){
+      audio_memory::deallocate(memory);
+    }
+    else{
+      arena->deallocate(memory, count * sizeof(T));
+    }
+  }
+
+  template<typename U>
+  bool operator==(const arena_allocator<U>& rhs) const{
+    return arena == rhs.arena;
+  }
+
+  template<typename U>
+  bool operator!=(const arena_allocator<U>& rhs) const{
+    return arena != rhs.arena;
+  }
+};
+
+#endif
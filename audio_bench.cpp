@@ -0,0 +1,163 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "audio.h"
+
+// every heap allocation in the process goes through here so each operation
+// can report how many buffers it allocates per call
+static std::atomic<std::size_t> allocations(0);
+
+void* operator new(std::size_t size){
+  ++allocations;
+  if(void* memory = std::malloc(size ? size : 1)){
+    return memory;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept{
+  std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept{
+  std::free(memory);
+}
+
+struct measurement{
+  std::size_t calls;
+  double seconds;
+  double allocations_per_call;
+};
+
+static bool first_result = true;
+
+// repeats operation until it has run for min_seconds, at least once; reset,
+// when given, runs untimed before every call
+static measurement measure(const std::function<void()>& operation, double min_seconds,
+                           const std::function<void()>& reset = nullptr){
+  measurement result = {0, 0, 0};
+  std::size_t allocated = 0;
+  do{
+    if(reset){
+      reset();
+    }
+    std::size_t before = allocations;
+    auto start = std::chrono::steady_clock::now();
+    operation();
+    result.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    allocated += allocations - before;
+    ++result.calls;
+  } while(result.seconds < min_seconds);
+  result.allocations_per_call = (double)allocated / result.calls;
+  return result;
+}
+
+static void report(const std::string& type, const std::string& layout, const std::string& operation,
+                   std::size_t bytes, std::size_t samples, const measurement& result){
+  std::printf("%s    {\"type\": \"%s\", \"layout\": \"%s\", \"operation\": \"%s\", \"bytes\": %zu, \"samples\": %zu, "
+              "\"calls\": %zu, \"seconds\": %.6f, \"samples_per_second\": %.0f, \"bytes_per_second\": %.0f, "
+              "\"allocations_per_call\": %.2f}",
+              first_result ? "" : ",\n", type.c_str(), layout.c_str(), operation.c_str(), bytes, samples,
+              result.calls, result.seconds, samples * (double)result.calls / result.seconds,
+              bytes * (double)result.calls / result.seconds, result.allocations_per_call);
+  first_result = false;
+  std::fflush(stdout);
+}
+
+template<typename T>
+static std::vector<T> make_samples(std::size_t count, unsigned seed){
+  std::vector<T> samples(count);
+  for(std::size_t i = 0; i < count; ++i){
+    samples[i] = (T)((i + seed) * 2654435761u >> 7);
+  }
+  return samples;
+}
+
+template<typename T>
+static std::vector<std::pair<T, T>> make_frames(std::size_t count, unsigned seed){
+  std::vector<T> left = make_samples<T>(count, seed), right = make_samples<T>(count, seed + 1);
+  std::vector<std::pair<T, T>> frames(count);
+  for(std::size_t i = 0; i < count; ++i){
+    frames[i] = std::make_pair(left[i], right[i]);
+  }
+  return frames;
+}
+
+volatile std::size_t sink;
+
+// runs every operation of one clip type; Clip is audio<T> or audio<std::pair<T, T>>.
+// The in place operations work on a copy of a restored before every call, so
+// each call and every later operation sees the original samples.
+template<typename Clip, typename Rms>
+static void bench_clip(const std::string& type, const std::string& layout, const Clip& a, const Clip& b,
+                       std::size_t bytes, std::size_t samples, std::size_t frames, const Rms& rms, double min_seconds){
+  const std::pair<float, float> gain = {0.75f, 0.5f};
+  const std::pair<int, int> quarter = {(int)frames / 4, (int)frames / 2 - 1};
+  const std::pair<int, int> second_quarter = {(int)frames / 2, (int)(frames * 3 / 4) - 1};
+  const std::pair<int, int> other_quarter = {0, (int)frames / 4 - 1};
+  float seconds = frames / 2.0f / a.get_sample_length();
+
+  Clip work = a;
+  auto run = [&](const std::string& operation, const std::function<void()>& body){
+    report(type, layout, operation, bytes, samples, measure(body, min_seconds));
+  };
+  auto run_in_place = [&](const std::string& operation, const std::function<void()>& body){
+    report(type, layout, operation, bytes, samples, measure(body, min_seconds, [&]{ work = a; }));
+  };
+
+  run("|", [&]{ sink = (a | b).get_sample_length(); });
+  run("*", [&]{ sink = (a * gain).get_sample_length(); });
+  run("+", [&]{ sink = (a + b).get_sample_length(); });
+  run("^", [&]{ sink = (a ^ quarter).get_sample_length(); });
+  run_in_place("*=", [&]{ work *= gain; });
+  run_in_place("+=", [&]{ work += b; });
+  run_in_place("reverse", [&]{ work.reverse(); });
+  run("ranged_add", [&]{ sink = a.ranged_add(second_quarter, other_quarter, b).get_sample_length(); });
+  run("calculate_rms", [&]{ sink = (std::size_t)rms(a.calculate_rms()); });
+  run("normalize", [&]{ sink = a.normalize(a.calculate_rms(), 1000).get_sample_length(); });
+  run("fade_in", [&]{ sink = a.fade_in(seconds).get_sample_length(); });
+  run("fade_out", [&]{ sink = a.fade_out(seconds, fade_curve::equal_power).get_sample_length(); });
+}
+
+template<typename T>
+static void bench_type(const std::string& type, std::size_t max_bytes, double min_seconds){
+  for(std::size_t bytes = 1 << 10; bytes <= max_bytes; bytes *= 4){
+    std::size_t samples = bytes / sizeof(T);
+    bench_clip(type, "mono",
+               audio<T>(make_samples<T>(samples, 1), 44100), audio<T>(make_samples<T>(samples, 2), 44100),
+               bytes, samples, samples, [](float rms){ return rms; }, min_seconds);
+
+    std::size_t frames = samples / 2;
+    bench_clip(type, "stereo",
+               audio<std::pair<T, T>>(make_frames<T>(frames, 1), 44100), audio<std::pair<T, T>>(make_frames<T>(frames, 3), 44100),
+               bytes, 2 * frames, frames, [](std::pair<float, float> rms){ return rms.first + rms.second; }, min_seconds);
+
+    std::vector<T> lhs = make_samples<T>(samples, 1), rhs = make_samples<T>(samples, 2), out(samples);
+    report(type, "kernel", "saturating_add_scalar", bytes, samples, measure([&]{
+      audio_kernels::saturating_add_scalar(lhs.data(), rhs.data(), out.data(), samples);
+    }, min_seconds));
+    report(type, "kernel", "saturating_add", bytes, samples, measure([&]{
+      audio_kernels::saturating_add(lhs.data(), rhs.data(), out.data(), samples);
+    }, min_seconds));
+  }
+}
+
+// usage: audio_bench [max_bytes] [min_seconds_per_measurement]
+int main(int argc, char* argv[]){
+  std::size_t max_bytes = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : (std::size_t)1 << 30;
+  double min_seconds = argc > 2 ? std::atof(argv[2]) : 0.2;
+
+  std::printf("{\n  \"max_bytes\": %zu,\n  \"threads\": %u,\n  \"isa\": \"%s\",\n  \"results\": [\n", max_bytes,
+              audio_parallel::config().threads.load(), audio_kernels::isa_name(audio_kernels::active_isa()));
+  bench_type<int8_t>("int8", max_bytes, min_seconds);
+  bench_type<int16_t>("int16", max_bytes, min_seconds);
+  bench_type<int32_t>("int32", max_bytes, min_seconds);
+  std::printf("\n  ]\n}\n");
+  return 0;
+}
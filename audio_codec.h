@@ -0,0 +1,442 @@
+#ifndef AUDIO_CODEC_H
+#define AUDIO_CODEC_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "audio.h"
+#include "audio_parallel.h"
+
+// Lossless compressed clips. The frames are cut into blocks of a fixed
+// length; every channel of a block is predicted with the best of the fixed
+// polynomial predictors of order 0 to 4 and the residuals are Rice coded, as
+// in FLAC. The header is followed by an index of where each block ends, so
+// any frame range is decoded from just the blocks that cover it, and blocks
+// are encoded and decoded in parallel.
+//
+// Layout, little endian:
+//   "AUDZ", version, sample bytes, channels, 0
+//   sample_length (4), frames (8), block frames (4), block count (4)
+//   block count x end of the block in the data (8)
+//   blocks
+namespace audio_codec{
+
+const char magic[4] = {'A', 'U', 'D', 'Z'};
+const uint8_t version = 1;
+const std::size_t header_bytes = 28;
+const unsigned max_order = 4;
+const unsigned escape = 32;   // a run of this many ones is followed by the raw value
+
+inline void put(std::vector<uint8_t>& bytes, uint64_t value, int count){
+  for(int i = 0; i < count; ++i){
+    bytes.push_back((uint8_t)(value >> (8 * i)));
+  }
+}
+
+inline uint64_t get(const uint8_t* bytes, int count){
+  uint64_t value = 0;
+  for(int i = 0; i < count; ++i){
+    value |= (uint64_t)bytes[i] << (8 * i);
+  }
+  return value;
+}
+
+inline uint64_t zigzag(int64_t value){
+  return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+inline int64_t unzigzag(uint64_t value){
+  return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+// the fixed predictor of the given order; the first samples of a block fall
+// back to the orders their history allows
+inline int64_t predict(const int64_t* x, std::size_t i, unsigned order){
+  switch(order < i ? order : i){
+  case 0:
+    return 0;
+  case 1:
+    return x[i - 1];
+  case 2:
+    return 2 * x[i - 1] - x[i - 2];
+  case 3:
+    return 3 * (x[i - 1] - x[i - 2]) + x[i - 3];
+  default:
+    return 4 * (x[i - 1] + x[i - 3]) - 6 * x[i - 2] - x[i - 4];
+  }
+}
+
+// bits are packed from the least significant end of each byte
+class bit_writer{
+private:
+  std::vector<uint8_t>& bytes;
+  uint64_t buffer;
+  unsigned count;
+
+  void put_bits(uint64_t value, unsigned bits){
+    buffer |= (value & ((1ull << bits) - 1)) << count;
+    count += bits;
+    while(count >= 8){
+      bytes.push_back((uint8_t)buffer);
+      buffer >>= 8;
+      count -= 8;
+    }
+  }
+
+public:
+  explicit bit_writer(std::vector<uint8_t>& out) : bytes(out), buffer(0), count(0){}
+
+  void write(uint64_t value, unsigned bits){
+    for(; bits > 32; bits -= 32, value >>= 32){
+      put_bits(value, 32);
+    }
+    put_bits(value, bits);
+  }
+
+  void ones(unsigned run){
+    for(; run > 32; run -= 32){
+      put_bits(~0ull, 32);
+    }
+    put_bits(~0ull, run);
+  }
+
+  void rice(uint64_t value, unsigned k){
+    uint64_t quotient = value >> k;
+    if(quotient >= escape){
+      ones(escape);
+      write(value, 64);
+      return;
+    }
+    ones((unsigned)quotient);
+    put_bits(0, 1);
+    write(value, k);
+  }
+
+  void flush(){
+    if(count > 0){
+      bytes.push_back((uint8_t)buffer);
+      buffer = 0;
+      count = 0;
+    }
+  }
+};
+
+class bit_reader{
+private:
+  const uint8_t* bytes;
+  const uint8_t* end;
+  uint64_t buffer;
+  unsigned count;
+
+  void refill(){
+    while(count <= 56 && bytes != end){
+      buffer |= (uint64_t)*bytes++ << count;
+      count += 8;
+    }
+  }
+
+  void drop(unsigned bits){
+    buffer = bits < 64 ? buffer >> bits : 0;
+    count -= bits;
+  }
+
+  uint64_t take_bits(unsigned bits){
+    refill();
+    if(count < bits){
+      throw std::runtime_error("compressed_audio: truncated block");
+    }
+    uint64_t value = buffer & ((1ull << bits) - 1);
+    drop(bits);
+    return value;
+  }
+
+public:
+  bit_reader(const uint8_t* data, std::size_t size) : bytes(data), end(data + size), buffer(0), count(0){}
+
+  uint64_t read(unsigned bits){
+    uint64_t value = 0;
+    unsigned shift = 0;
+    for(; bits > 32; bits -= 32, shift += 32){
+      value |= take_bits(32) << shift;
+    }
+    return value | take_bits(bits) << shift;
+  }
+
+  // the number of ones before the next zero, which is consumed, up to limit
+  unsigned ones(unsigned limit){
+    unsigned run = 0;
+    while(true){
+      refill();
+      if(count == 0){
+        throw std::runtime_error("compressed_audio: truncated block");
+      }
+      uint64_t zeros = ~buffer;
+      unsigned found = zeros ? (unsigned)__builtin_ctzll(zeros) : 64;
+      found = std::min(found, count);
+      if(run + found >= limit){
+        drop(limit - run);
+        return limit;
+      }
+      if(found < count){
+        drop(found + 1);
+        return run + found;
+      }
+      drop(found);
+      run += found;
+    }
+  }
+
+  uint64_t rice(unsigned k){
+    unsigned quotient = ones(escape);
+    if(quotient == escape){
+      return read(64);
+    }
+    return (uint64_t)quotient << k | read(k);
+  }
+};
+
+// codes the n samples of one channel: predictor order, Rice parameter, residuals
+inline void encode_channel(const int64_t* x, std::size_t n, std::vector<uint64_t>& residuals, bit_writer& out){
+  unsigned order = 0;
+  uint64_t best = 0;
+  for(unsigned o = 0; o <= max_order; ++o){
+    uint64_t cost = 0;
+    for(std::size_t i = 0; i < n; ++i){
+      cost += zigzag(x[i] - predict(x, i, o));
+    }
+    if(o == 0 || cost < best){
+      order = o;
+      best = cost;
+    }
+  }
+  residuals.resize(n);
+  for(std::size_t i = 0; i < n; ++i){
+    residuals[i] = zigzag(x[i] - predict(x, i, order));
+  }
+  unsigned k = 0;
+  while(k < 48 && ((uint64_t)n << (k + 1)) <= best){
+    ++k;
+  }
+  out.write(order, 3);
+  out.write(k, 6);
+  for(std::size_t i = 0; i < n; ++i){
+    out.rice(residuals[i], k);
+  }
+}
+
+inline void decode_channel(bit_reader& in, std::size_t n, int64_t* x){
+  unsigned order = (unsigned)in.read(3), k = (unsigned)in.read(6);
+  if(order > max_order){
+    throw std::runtime_error("compressed_audio: corrupt block");
+  }
+  for(std::size_t i = 0; i < n; ++i){
+    x[i] = unzigzag(in.rice(k)) + predict(x, i, order);
+  }
+}
+
+// n frames of interleaved samples into bytes
+template<typename Sample>
+void encode_block(const Sample* samples, std::size_t n, int channels, std::vector<uint8_t>& bytes){
+  std::vector<int64_t> x(n);
+  std::vector<uint64_t> residuals;
+  bit_writer out(bytes);
+  for(int c = 0; c < channels; ++c){
+    for(std::size_t i = 0; i < n; ++i){
+      x[i] = (int64_t)samples[i * channels + c];
+    }
+    encode_channel(x.data(), n, residuals, out);
+  }
+  out.flush();
+}
+
+// decodes a block of n frames and stores frames [skip, skip + keep) to out
+template<typename Sample>
+void decode_block(const uint8_t* bytes, std::size_t size, std::size_t n, int channels, std::size_t skip, std::size_t keep, Sample* out){
+  std::vector<int64_t> x(n);
+  bit_reader in(bytes, size);
+  for(int c = 0; c < channels; ++c){
+    decode_channel(in, n, x.data());
+    for(std::size_t i = 0; i < keep; ++i){
+      out[i * channels + c] = (Sample)x[skip + i];
+    }
+  }
+}
+
+}
+
+// Writes clip to path in the compressed format. Only integer samples,
+// including int24, can be coded losslessly.
+template<typename T>
+void write_compressed(const std::string& path, const audio_view<T>& clip, std::size_t block_frames = 4096){
+  typedef typename audio_kernels::frame_traits<T>::sample sample;
+  static_assert(std::is_integral<sample>::value || std::is_same<sample, audio_kernels::int24>::value,
+                "write_compressed: samples must be integers");
+  const int channels = audio_kernels::frame_traits<T>::channels;
+  block_frames = std::max<std::size_t>(block_frames, 1);
+  std::size_t frames = clip.size(), count = (frames + block_frames - 1) / block_frames;
+  const sample* samples = reinterpret_cast<const sample*>(clip.data());
+
+  std::vector<std::vector<uint8_t>> blocks(count);
+  audio_parallel::for_each_task(count, [&](std::size_t b){
+    std::size_t first = b * block_frames;
+    audio_codec::encode_block(samples + first * channels, std::min(block_frames, frames - first), channels, blocks[b]);
+  });
+
+  std::vector<uint8_t> header(audio_codec::magic, audio_codec::magic + 4);
+  header.push_back(audio_codec::version);
+  header.push_back((uint8_t)sizeof(sample));
+  header.push_back((uint8_t)channels);
+  header.push_back(0);
+  audio_codec::put(header, (uint32_t)clip.get_sample_length(), 4);
+  audio_codec::put(header, frames, 8);
+  audio_codec::put(header, block_frames, 4);
+  audio_codec::put(header, count, 4);
+  uint64_t end = 0;
+  for(const std::vector<uint8_t>& block : blocks){
+    end += block.size();
+    audio_codec::put(header, end, 8);
+  }
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if(!file){
+    throw std::runtime_error("write_compressed: cannot create " + path);
+  }
+  file.write(reinterpret_cast<const char*>(header.data()), header.size());
+  for(const std::vector<uint8_t>& block : blocks){
+    file.write(reinterpret_cast<const char*>(block.data()), block.size());
+  }
+  if(!file){
+    throw std::runtime_error("write_compressed: cannot write " + path);
+  }
+}
+
+template<typename T, typename Alloc>
+void write_compressed(const std::string& path, const audio<T, Alloc>& clip, std::size_t block_frames = 4096){
+  write_compressed(path, clip.view(), block_frames);
+}
+
+// A compressed file opened for reading. Only the header and the block index
+// are loaded; read() fetches and decodes the blocks a range needs. T is the
+// frame type the file was written with.
+template<typename T>
+class compressed_audio{
+private:
+  typedef typename audio_kernels::frame_traits<T>::sample sample;
+  static const int channels = audio_kernels::frame_traits<T>::channels;
+
+  std::string path;
+  int sample_length;
+  std::size_t frames;
+  std::size_t block_frames;
+  std::size_t data_start;
+  std::vector<uint64_t> ends;
+
+  uint64_t block_begin(std::size_t b) const{
+    return b == 0 ? 0 : ends[b - 1];
+  }
+
+  // decodes frames [first, last)
+  audio<T> decode(std::size_t first, std::size_t last) const{
+    if(last <= first){
+      return audio<T>(std::vector<T>(), sample_length);
+    }
+    std::size_t first_block = first / block_frames, end_block = (last - 1) / block_frames + 1;
+    uint64_t offset = block_begin(first_block);
+    std::vector<uint8_t> bytes(ends[end_block - 1] - offset);
+    std::ifstream file(path, std::ios::binary);
+    file.seekg(data_start + offset);
+    if(!file.read(reinterpret_cast<char*>(bytes.data()), bytes.size())){
+      throw std::runtime_error("compressed_audio: truncated data in " + path);
+    }
+
+    std::vector<T> result(last - first);
+    sample* out = reinterpret_cast<sample*>(result.data());
+    audio_parallel::for_each_task(end_block - first_block, [&](std::size_t task){
+      std::size_t b = first_block + task, begin = b * block_frames;
+      std::size_t n = std::min(block_frames, frames - begin);
+      std::size_t skip = first > begin ? first - begin : 0;
+      std::size_t keep = std::min(begin + n, last) - begin - skip;
+      audio_codec::decode_block(bytes.data() + (block_begin(b) - offset), ends[b] - block_begin(b), n, channels,
+                                skip, keep, out + (begin + skip - first) * channels);
+    });
+    return audio<T>(std::move(result), sample_length);
+  }
+
+public:
+  explicit compressed_audio(const std::string& file_path) : path(file_path){
+    std::ifstream file(path, std::ios::binary);
+    if(!file){
+      throw std::runtime_error("compressed_audio: cannot open " + path);
+    }
+    uint8_t header[audio_codec::header_bytes];
+    if(!file.read(reinterpret_cast<char*>(header), sizeof(header)) || std::memcmp(header, audio_codec::magic, 4) != 0){
+      throw std::runtime_error("compressed_audio: not a compressed clip: " + path);
+    }
+    if(header[4] != audio_codec::version || header[5] != sizeof(sample) || header[6] != channels){
+      throw std::runtime_error("compressed_audio: format mismatch in " + path);
+    }
+    sample_length = (int)(int32_t)audio_codec::get(header + 8, 4);
+    frames = audio_codec::get(header + 12, 8);
+    block_frames = audio_codec::get(header + 20, 4);
+    std::size_t count = audio_codec::get(header + 24, 4);
+    file.seekg(0, std::ios::end);
+    uint64_t file_bytes = (uint64_t)file.tellg();
+    file.seekg(audio_codec::header_bytes);
+    if(block_frames == 0 || count != frames / block_frames + (frames % block_frames != 0) ||
+       count > (file_bytes - audio_codec::header_bytes) / 8){
+      throw std::runtime_error("compressed_audio: corrupt header in " + path);
+    }
+    std::vector<uint8_t> index(count * 8);
+    if(!file.read(reinterpret_cast<char*>(index.data()), index.size())){
+      throw std::runtime_error("compressed_audio: truncated index in " + path);
+    }
+    data_start = audio_codec::header_bytes + index.size();
+    // every channel of a block codes at least its predictor and Rice parameter
+    // (9 bits) and one bit per frame, so the offsets bound the frame counts too
+    ends.resize(count);
+    for(std::size_t b = 0; b < count; ++b){
+      ends[b] = audio_codec::get(index.data() + 8 * b, 8);
+      uint64_t begin = block_begin(b), n = std::min(block_frames, frames - b * block_frames);
+      if(ends[b] <= begin || ends[b] > file_bytes - data_start || (ends[b] - begin) * 8 < channels * (9 + n)){
+        throw std::runtime_error("compressed_audio: corrupt index in " + path);
+      }
+    }
+  }
+
+  std::size_t size() const{
+    return frames;
+  }
+
+  int get_sample_length() const{
+    return sample_length;
+  }
+
+  std::size_t block_count() const{
+    return ends.size();
+  }
+
+  // bytes of coded samples, without the header and index
+  std::size_t compressed_bytes() const{
+    return ends.empty() ? 0 : ends.back();
+  }
+
+  // frames [range.first, range.second], clamped to the clip like audio::view
+  audio<T> read(const std::pair<int, int>& range) const{
+    std::pair<std::size_t, std::size_t> span = clamp_range(range, frames);
+    return decode(span.first, span.second);
+  }
+
+  audio<T> to_audio() const{
+    return decode(0, frames);
+  }
+};
+
+#endif
@@ -0,0 +1,172 @@
+#ifndef AUDIO_EDIT_H
+#define AUDIO_EDIT_H
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+#include "audio.h"
+
+// A piece table over immutable source clips. T is the frame type, as for
+// audio<T>. Concatenation, cuts, slices and inserts only rewrite the list of
+// (source, offset, length) pieces; samples are copied only when read back
+// through operator[] or exported with to_audio() / write().
+template<typename T>
+class audio_edit{
+private:
+  struct piece{
+    std::shared_ptr<const std::vector<T>> source;
+    std::size_t offset;
+    std::size_t length;
+  };
+
+  std::vector<piece> pieces;
+  std::vector<std::size_t> starts;
+  std::size_t length;
+  int sample_length;
+
+  void index(){
+    starts.resize(pieces.size());
+    length = 0;
+    for(std::size_t p = 0; p < pieces.size(); ++p){
+      starts[p] = length;
+      length += pieces[p].length;
+    }
+  }
+
+  // the piece holding frame position, which must be below length
+  std::size_t locate(std::size_t position) const{
+    return std::upper_bound(starts.begin(), starts.end(), position) - starts.begin() - 1;
+  }
+
+  // splits the piece under position so that a piece starts exactly there
+  // and returns its index
+  std::size_t split(std::size_t position){
+    if(position >= length){
+      return pieces.size();
+    }
+    std::size_t p = locate(position);
+    std::size_t into = position - starts[p];
+    if(into != 0){
+      piece tail = {pieces[p].source, pieces[p].offset + into, pieces[p].length - into};
+      pieces[p].length = into;
+      pieces.insert(pieces.begin() + p + 1, tail);
+      index();
+      ++p;
+    }
+    return p;
+  }
+
+public:
+  audio_edit() : length(0), sample_length(0){}
+
+  audio_edit(std::vector<T> samples, int sampl_len) : length(0), sample_length(sampl_len){
+    std::size_t size = samples.size();
+    if(size != 0){
+      piece whole = {std::make_shared<const std::vector<T>>(std::move(samples)), 0, size};
+      pieces.push_back(whole);
+    }
+    index();
+  }
+
+  audio_edit(const audio<T>& clip) : audio_edit(clip.get_buffer(), clip.get_sample_length()){}
+
+  std::size_t size() const{
+    return length;
+  }
+
+  std::size_t piece_count() const{
+    return pieces.size();
+  }
+
+  int get_sample_length() const{
+    return sample_length;
+  }
+
+  T operator[](std::size_t position) const{
+    std::size_t at = locate(position);
+    const piece& p = pieces[at];
+    return (*p.source)[p.offset + position - starts[at]];
+  }
+
+  audio_edit& operator|=(const audio_edit& rhs){
+    std::vector<piece> appended(rhs.pieces);
+    pieces.insert(pieces.end(), appended.begin(), appended.end());
+    index();
+    return *this;
+  }
+
+  audio_edit operator|(const audio_edit& rhs) const{
+    audio_edit result = *this;
+    result |= rhs;
+    return result;
+  }
+
+  // removes the inclusive range, like audio<T>::operator^
+  audio_edit& operator^=(const std::pair<int, int>& range){
+    std::pair<std::size_t, std::size_t> cut = clamp_range(range, length);
+    std::size_t first = cut.first, last = cut.second;
+    if(first < last){
+      std::size_t begin = split(first);
+      std::size_t end = split(last);
+      pieces.erase(pieces.begin() + begin, pieces.begin() + end);
+      index();
+    }
+    return *this;
+  }
+
+  audio_edit operator^(const std::pair<int, int>& range) const{
+    audio_edit result = *this;
+    result ^= range;
+    return result;
+  }
+
+  // the inclusive range as a new edit sharing the same sources
+  audio_edit slice(const std::pair<int, int>& range) const{
+    audio_edit result = *this;
+    std::pair<std::size_t, std::size_t> span = clamp_range(range, length);
+    std::size_t first = span.first, last = span.second;
+    if(first >= last){
+      result.pieces.clear();
+      result.index();
+      return result;
+    }
+    std::size_t end = result.split(last);
+    result.pieces.erase(result.pieces.begin() + end, result.pieces.end());
+    result.index();
+    std::size_t begin = result.split(first);
+    result.pieces.erase(result.pieces.begin(), result.pieces.begin() + begin);
+    result.index();
+    return result;
+  }
+
+  // pastes clip so that its first frame lands at position
+  audio_edit& insert(std::size_t position, const audio_edit& clip){
+    std::vector<piece> inserted(clip.pieces);
+    std::size_t at = split(std::min(position, length));
+    pieces.insert(pieces.begin() + at, inserted.begin(), inserted.end());
+    index();
+    return *this;
+  }
+
+  audio<T> to_audio() const{
+    std::vector<T> samples;
+    samples.reserve(length);
+    for(const piece& p : pieces){
+      samples.insert(samples.end(), p.source->begin() + p.offset, p.source->begin() + p.offset + p.length);
+    }
+    return audio<T>(std::move(samples), sample_length);
+  }
+
+  // streams the edit as raw frames without building the whole clip
+  void write(std::ostream& output) const{
+    for(const piece& p : pieces){
+      output.write(reinterpret_cast<const char*>(p.source->data() + p.offset), p.length * sizeof(T));
+    }
+  }
+};
+
+#endif
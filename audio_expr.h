@@ -0,0 +1,200 @@
+#ifndef AUDIO_EXPR_H
+#define AUDIO_EXPR_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+#include "audio.h"
+
+// Lazy mixing expressions. lazy(a) * gain + lazy(b) * gain2 builds a tree of
+// nodes instead of clips; assigning it to an audio object evaluates the whole
+// tree in one pass over the sources, in double precision, and saturates only
+// when storing the result. Mono and stereo clips take a pair of gains, clips
+// of std::array<T, N> frames a std::array<float, N>.
+namespace audio_expr{
+
+template<typename E>
+struct expression{
+  const E& self() const{
+    return static_cast<const E&>(*this);
+  }
+};
+
+// leaf over a mono clip
+template<typename T>
+struct clip : expression<clip<T>>{
+  typedef T frame;
+  typedef T sample;
+  static const int channels = 1;
+
+  const T* samples;
+  std::size_t length;
+  int sample_length;
+
+  template<typename A>
+  clip(const audio<T, A>& source) : samples(source.mono.data()), length(source.mono.size()), sample_length(source.sample_length){}
+
+  std::size_t size() const{
+    return length;
+  }
+
+  double operator[](std::size_t index) const{
+    return samples[index];
+  }
+};
+
+// leaf over a stereo clip, indexed by interleaved sample
+template<typename T>
+struct clip<std::pair<T, T>> : expression<clip<std::pair<T, T>>>{
+  typedef std::pair<T, T> frame;
+  typedef T sample;
+  static const int channels = 2;
+
+  const T* samples;
+  std::size_t length;
+  int sample_length;
+
+  template<typename A>
+  clip(const audio<std::pair<T, T>, A>& source)
+    : samples(reinterpret_cast<const T*>(source.stereo.data())), length(source.stereo.size()), sample_length(source.sample_length){}
+
+  std::size_t size() const{
+    return length;
+  }
+
+  double operator[](std::size_t index) const{
+    return samples[index];
+  }
+};
+
+// leaf over an N channel clip, indexed by interleaved sample
+template<typename T, std::size_t N>
+struct clip<std::array<T, N>> : expression<clip<std::array<T, N>>>{
+  typedef std::array<T, N> frame;
+  typedef T sample;
+  static const int channels = N;
+
+  const T* samples;
+  std::size_t length;
+  int sample_length;
+
+  template<typename A>
+  clip(const audio<std::array<T, N>, A>& source)
+    : samples(reinterpret_cast<const T*>(source.frames.data())), length(source.frames.size()), sample_length(source.sample_length){}
+
+  std::size_t size() const{
+    return length;
+  }
+
+  double operator[](std::size_t index) const{
+    return samples[index];
+  }
+};
+
+// gains are one per channel; a pair scales mono clips by its first gain
+template<typename E>
+struct scaled : expression<scaled<E>>{
+  typedef typename E::frame frame;
+  typedef typename E::sample sample;
+  static const int channels = E::channels;
+
+  E operand;
+  double gain[channels < 2 ? 2 : channels];
+  int sample_length;
+
+  scaled(const E& expr, const std::pair<float, float>& volume_factor)
+    : operand(expr), gain{volume_factor.first, volume_factor.second}, sample_length(expr.sample_length){}
+
+  scaled(const E& expr, const std::array<float, channels>& volume_factor) : operand(expr), sample_length(expr.sample_length){
+    std::copy(volume_factor.begin(), volume_factor.end(), gain);
+  }
+
+  std::size_t size() const{
+    return operand.size();
+  }
+
+  double operator[](std::size_t index) const{
+    return operand[index] * gain[index % channels];
+  }
+};
+
+template<typename L, typename R>
+struct sum : expression<sum<L, R>>{
+  static_assert(std::is_same<typename L::frame, typename R::frame>::value, "mixed clips must share a frame type");
+
+  typedef typename L::frame frame;
+  typedef typename L::sample sample;
+  static const int channels = L::channels;
+
+  L lhs;
+  R rhs;
+  int sample_length;
+
+  sum(const L& left, const R& right) : lhs(left), rhs(right), sample_length(left.sample_length){}
+
+  std::size_t size() const{
+    return std::min(lhs.size(), rhs.size());
+  }
+
+  double operator[](std::size_t index) const{
+    return lhs[index] + rhs[index];
+  }
+};
+
+template<typename T, typename A>
+clip<T> lazy(const audio<T, A>& source){
+  return clip<T>(source);
+}
+
+template<typename E>
+scaled<E> operator*(const expression<E>& expr, const std::pair<float, float>& volume_factor){
+  static_assert(E::channels <= 2, "N channel clips take one gain per channel");
+  return scaled<E>(expr.self(), volume_factor);
+}
+
+template<typename E, std::size_t N>
+scaled<E> operator*(const expression<E>& expr, const std::array<float, N>& volume_factor){
+  static_assert(N == E::channels, "one gain per channel");
+  return scaled<E>(expr.self(), volume_factor);
+}
+
+template<typename L, typename R>
+sum<L, R> operator+(const expression<L>& lhs, const expression<R>& rhs){
+  return sum<L, R>(lhs.self(), rhs.self());
+}
+
+// floating point samples are only narrowed
+template<typename S>
+S store(double value, std::true_type){
+  return audio_kernels::sample_traits<S>::from_product(value);
+}
+
+// integer samples are clamped first and then rounded like from_product, so
+// the double never overflows the conversion
+template<typename S>
+S store(double value, std::false_type){
+  typedef audio_kernels::sample_traits<S> traits;
+  if(!std::isfinite(value)){
+    return S();
+  }
+  value = std::min(std::max(value, (double)traits::min()), (double)traits::max());
+  return traits::saturate((typename traits::accumulator)audio_kernels::round_to<traits::round_mode>::apply(value));
+}
+
+// the single fused pass; out holds size() frames
+template<typename E, typename S>
+void evaluate(const expression<E>& expr, S* out){
+  const E& tree = expr.self();
+  std::size_t count = tree.size() * E::channels;
+  for(std::size_t i = 0; i < count; ++i){
+    out[i] = store<S>(tree[i], typename std::is_floating_point<S>::type());
+  }
+}
+
+}
+
+#endif
@@ -0,0 +1,185 @@
+#ifndef AUDIO_IO_H
+#define AUDIO_IO_H
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "audio.h"
+
+enum class map_mode{
+  read_only,      // PROT_READ, any write faults
+  copy_on_write,  // private mapping, writes never reach the file
+  output          // shared mapping of a newly created file
+};
+
+// A raw clip mapped straight from disk. T is the frame type, so
+// mapped_audio<int16_t> is a mono clip and mapped_audio<std::pair<int16_t, int16_t>>
+// an interleaved stereo one. Opening costs one mmap, independent of the size.
+// The zero copy interface is view(), an audio_view over the mapping. An
+// owning audio<T> cannot alias the mapping: its std::vector value initializes
+// whatever its allocator hands out and frees it on destruction, so even a
+// custom allocator would overwrite the samples and then munmap under its
+// owner. to_audio() is the one way to an audio<T>, and it copies.
+template<typename T>
+class mapped_audio{
+private:
+  T* samples;
+  std::size_t length;
+  int sample_length;
+
+  void release(){
+    if(samples != nullptr){
+      munmap(samples, length * sizeof(T));
+    }
+    samples = nullptr;
+    length = 0;
+  }
+
+  static T* map_file(int fd, std::size_t bytes, int protection, int flags){
+    if(bytes == 0){
+      return nullptr;
+    }
+    void* address = mmap(nullptr, bytes, protection, flags, fd, 0);
+    if(address == MAP_FAILED){
+      close(fd);
+      throw std::runtime_error("mapped_audio: mmap failed");
+    }
+    return static_cast<T*>(address);
+  }
+
+public:
+  mapped_audio() : samples(nullptr), length(0), sample_length(0){}
+
+  mapped_audio(const std::string& path, int sampl_len, map_mode mode = map_mode::read_only)
+    : samples(nullptr), length(0), sample_length(sampl_len){
+    int fd = open(path.c_str(), mode == map_mode::read_only ? O_RDONLY : O_RDWR);
+    if(fd < 0 && mode == map_mode::copy_on_write){
+      fd = open(path.c_str(), O_RDONLY);
+    }
+    if(fd < 0){
+      throw std::runtime_error("mapped_audio: cannot open " + path);
+    }
+    struct stat info;
+    if(fstat(fd, &info) != 0){
+      close(fd);
+      throw std::runtime_error("mapped_audio: cannot stat " + path);
+    }
+    length = info.st_size / sizeof(T);
+    int protection = mode == map_mode::read_only ? PROT_READ : PROT_READ | PROT_WRITE;
+    int flags = mode == map_mode::output ? MAP_SHARED : MAP_PRIVATE;
+    samples = map_file(fd, length * sizeof(T), protection, flags);
+    close(fd);
+    if(samples != nullptr){
+      madvise(samples, length * sizeof(T), MADV_SEQUENTIAL);
+    }
+  }
+
+  // creates (or truncates) path to hold size frames and maps it for writing
+  static mapped_audio create(const std::string& path, std::size_t size, int sampl_len){
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0){
+      throw std::runtime_error("mapped_audio: cannot create " + path);
+    }
+    if(ftruncate(fd, size * sizeof(T)) != 0){
+      close(fd);
+      throw std::runtime_error("mapped_audio: cannot resize " + path);
+    }
+    mapped_audio result;
+    result.samples = map_file(fd, size * sizeof(T), PROT_READ | PROT_WRITE, MAP_SHARED);
+    result.length = size;
+    result.sample_length = sampl_len;
+    close(fd);
+    return result;
+  }
+
+  ~mapped_audio(){
+    release();
+  }
+
+  mapped_audio(const mapped_audio& rhs) = delete;
+
+  mapped_audio& operator=(const mapped_audio& rhs) = delete;
+
+  mapped_audio(mapped_audio&& rhs) : samples(rhs.samples), length(rhs.length), sample_length(rhs.sample_length){
+    rhs.samples = nullptr;
+    rhs.length = 0;
+  }
+
+  mapped_audio& operator=(mapped_audio&& rhs){
+    if(this != &rhs){
+      release();
+      samples = rhs.samples;
+      length = rhs.length;
+      sample_length = rhs.sample_length;
+      rhs.samples = nullptr;
+      rhs.length = 0;
+    }
+    return *this;
+  }
+
+  T& operator[](std::size_t index){
+    return samples[index];
+  }
+
+  const T& operator[](std::size_t index) const{
+    return samples[index];
+  }
+
+  T* data(){
+    return samples;
+  }
+
+  const T* data() const{
+    return samples;
+  }
+
+  std::size_t size() const{
+    return length;
+  }
+
+  T* begin(){
+    return samples;
+  }
+
+  T* end(){
+    return samples + length;
+  }
+
+  const T* begin() const{
+    return samples;
+  }
+
+  const T* end() const{
+    return samples + length;
+  }
+
+  int get_sample_length() const{
+    return sample_length;
+  }
+
+  // flushes an output mapping to disk
+  void sync(){
+    if(samples != nullptr && msync(samples, length * sizeof(T), MS_SYNC) != 0){
+      throw std::runtime_error("mapped_audio: msync failed");
+    }
+  }
+
+  audio_view<T> view() const{
+    return audio_view<T>(samples, length, sample_length);
+  }
+
+  // the one explicit copy, for callers that need an owning clip; see the
+  // class comment for why it cannot share the mapping
+  audio<T> to_audio() const{
+    return audio<T>(std::vector<T>(begin(), end()), sample_length);
+  }
+};
+
+#endif
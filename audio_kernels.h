@@ -0,0 +1,1005 @@
+#ifndef AUDIO_KERNELS_H
+#define AUDIO_KERNELS_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+#include <utility>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// with GCC or Clang on x86 the AVX2 and AVX-512 kernels are compiled through
+// target attributes, whatever the -m flags, and picked at run time
+#if defined(__SSE2__) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define AUDIO_KERNELS_DISPATCH
+#include <immintrin.h>
+#endif
+
+namespace audio_kernels{
+
+// instruction set levels with kernel variants, lowest first
+enum class isa{
+  scalar,
+  sse2,
+  avx2,
+  avx512   // AVX-512 F and BW
+};
+
+inline const char* isa_name(isa level){
+  static const char* names[] = {"scalar", "sse2", "avx2", "avx512"};
+  return names[(int)level];
+}
+
+// the best level this cpu supports
+inline isa supported_isa(){
+#if defined(AUDIO_KERNELS_DISPATCH)
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")){
+    return isa::avx512;
+  }
+  if(__builtin_cpu_supports("avx2")){
+    return isa::avx2;
+  }
+  return isa::sse2;
+#elif defined(__SSE2__)
+  return isa::sse2;
+#else
+  return isa::scalar;
+#endif
+}
+
+// supported_isa(), or the level named by AUDIO_ISA (scalar, sse2, avx2 or
+// avx512) when that is lower; a level the cpu lacks is never selected
+inline isa startup_isa(){
+  isa best = supported_isa();
+  const char* forced = std::getenv("AUDIO_ISA");
+  for(int level = 0; forced != nullptr && level <= (int)isa::avx512; ++level){
+    if(std::strcmp(forced, isa_name((isa)level)) == 0){
+      return std::min(best, (isa)level);
+    }
+  }
+  return best;
+}
+
+inline std::atomic<int>& isa_level(){
+  static std::atomic<int> level((int)startup_isa());
+  return level;
+}
+
+inline isa active_isa(){
+  return (isa)isa_level().load(std::memory_order_relaxed);
+}
+
+// switches every kernel to level, or to the best supported level below it
+inline void set_isa(isa level){
+  isa_level() = (int)std::min(level, supported_isa());
+}
+
+// A frame is one sample, an interleaved pair of them for stereo, or an array
+// of N. levels holds one value per channel, such as an rms; gains is what
+// the volume operators take, which is a pair for mono clips too.
+template<typename T>
+struct frame_traits{
+  typedef T sample;
+  typedef float levels;
+  typedef std::pair<float, float> gains;
+  static const int channels = 1;
+};
+
+template<typename T>
+struct frame_traits<std::pair<T, T>>{
+  typedef T sample;
+  typedef std::pair<float, float> levels;
+  typedef std::pair<float, float> gains;
+  static const int channels = 2;
+};
+
+template<typename T, std::size_t N>
+struct frame_traits<std::array<T, N>>{
+  typedef T sample;
+  typedef std::array<float, N> levels;
+  typedef std::array<float, N> gains;
+  static const int channels = N;
+};
+
+// A packed little endian 24 bit sample, as stored in 24 bit PCM. It converts
+// to and from int32_t, so clips of it run through the scalar kernels.
+struct int24{
+  uint8_t bytes[3];
+
+  int24() : bytes{0, 0, 0}{}
+
+  int24(int32_t value) : bytes{(uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16)}{}
+
+  operator int32_t() const{
+    return (int32_t)((uint32_t)bytes[0] << 8 | (uint32_t)bytes[1] << 16 | (uint32_t)bytes[2] << 24) >> 8;
+  }
+};
+
+enum class rounding{
+  truncate,  // towards zero, like a cast
+  nearest    // halves to even, like cvtps in the default rounding mode
+};
+
+template<rounding Mode>
+struct round_to{
+  template<typename P>
+  static P apply(P value){
+    return value;
+  }
+};
+
+// adding and taking away 1.5 * 2^23 (2^52 for double) leaves no fraction
+// bits, so the hardware rounds like cvtps does; exact below 2^22 (2^51),
+// which covers every product from_product lets through
+template<>
+struct round_to<rounding::nearest>{
+  static float apply(float value){
+    return (value + 12582912.0f) - 12582912.0f;
+  }
+
+  static double apply(double value){
+    return (value + 6755399441055744.0) - 6755399441055744.0;
+  }
+};
+
+// Everything the kernels need to know about a sample type, fixed at compile
+// time: accumulator is wide enough to add two samples, square_accumulator
+// sums squares (exactly up to 16 bits), product is the precision of gain
+// multiplications, round_mode is how from_product turns a product back into
+// a sample, and lanes is how many fit in one 128 bit register, which sets
+// the stride of the vector kernels.
+template<typename T, bool Integral = std::is_integral<T>::value>
+struct sample_traits{
+  typedef int64_t accumulator;
+  typedef typename std::conditional<sizeof(T) <= 2, int64_t, double>::type square_accumulator;
+  typedef typename std::conditional<sizeof(T) <= 2, float, double>::type product;
+  static const rounding round_mode = rounding::nearest;
+  static const std::size_t lanes = 16 / sizeof(T);
+
+  static constexpr accumulator min(){
+    return std::numeric_limits<T>::min();
+  }
+
+  static constexpr accumulator max(){
+    return std::numeric_limits<T>::max();
+  }
+
+  static T saturate(accumulator value){
+    return (T)std::min(std::max(value, min()), max());
+  }
+
+  // clamped before the conversion, so out of range products never overflow
+  // it; products that are not finite give silence
+  static T from_product(product value){
+    if(!std::isfinite(value)){
+      return T();
+    }
+    if(value >= max()){
+      return (T)max();
+    }
+    if(value <= min()){
+      return (T)min();
+    }
+    return (T)(accumulator)round_to<round_mode>::apply(value);
+  }
+};
+
+template<>
+struct sample_traits<int24, false>{
+  typedef int64_t accumulator;
+  typedef double square_accumulator;
+  typedef double product;
+  static const rounding round_mode = rounding::nearest;
+  static const std::size_t lanes = 1;
+
+  static constexpr accumulator min(){
+    return -(1 << 23);
+  }
+
+  static constexpr accumulator max(){
+    return (1 << 23) - 1;
+  }
+
+  static int24 saturate(accumulator value){
+    return int24((int32_t)std::min(std::max(value, min()), max()));
+  }
+
+  static int24 from_product(product value){
+    if(!std::isfinite(value)){
+      return int24();
+    }
+    if(value >= max()){
+      return int24((int32_t)max());
+    }
+    if(value <= min()){
+      return int24((int32_t)min());
+    }
+    return int24((int32_t)round_to<round_mode>::apply(value));
+  }
+};
+
+// floating point samples are never clamped; full scale is +-1 by convention.
+// Products are only narrowed, never rounded to whole numbers, so there is no
+// round_mode.
+template<typename T>
+struct sample_traits<T, false>{
+  typedef double accumulator;
+  typedef double square_accumulator;
+  typedef double product;
+  static const std::size_t lanes = 16 / sizeof(T);
+
+  static T saturate(accumulator value){
+    return (T)value;
+  }
+
+  static T from_product(product value){
+    return std::isfinite(value) ? (T)value : T();
+  }
+};
+
+template<typename T>
+struct widened{
+  typedef typename sample_traits<T>::accumulator type;
+};
+
+template<typename T>
+inline T saturate(typename widened<T>::type value){
+  return sample_traits<T>::saturate(value);
+}
+
+// sample times gain at the precision, rounding and bounds of its type
+template<typename T>
+inline T scale(T sample, float gain){
+  return sample_traits<T>::from_product((typename sample_traits<T>::product)sample * gain);
+}
+
+// reference path, also used for every tail and for types without a vector kernel
+template<typename T>
+void saturating_add_scalar(const T* lhs, const T* rhs, T* out, std::size_t n){
+  for(std::size_t i = 0; i < n; ++i){
+    out[i] = saturate<T>((typename widened<T>::type)lhs[i] + rhs[i]);
+  }
+}
+
+template<typename T>
+void saturating_add(const T* lhs, const T* rhs, T* out, std::size_t n){
+  saturating_add_scalar(lhs, rhs, out, n);
+}
+
+template<typename T>
+struct square_accumulator{
+  typedef typename sample_traits<T>::square_accumulator type;
+};
+
+// per channel sums for interleaved clips of up to Channels channels
+template<typename A, int Channels = 2>
+struct channel_sums{
+  A sum[Channels];
+
+  channel_sums(){
+    std::fill(sum, sum + Channels, A());
+  }
+
+  channel_sums& operator+=(const channel_sums& rhs){
+    for(int c = 0; c < Channels; ++c){
+      sum[c] += rhs.sum[c];
+    }
+    return *this;
+  }
+};
+
+// what normalizing measures: the rms or the absolute peak of each channel
+enum class level_measure{
+  rms,
+  peak
+};
+
+// per channel absolute peaks; += keeps the larger of each pair, so chunked
+// partial results merge like channel_sums do
+template<typename A, int Channels = 2>
+struct channel_peaks{
+  A peak[Channels];
+
+  channel_peaks(){
+    std::fill(peak, peak + Channels, A());
+  }
+
+  channel_peaks& operator+=(const channel_peaks& rhs){
+    for(int c = 0; c < Channels; ++c){
+      peak[c] = std::max(peak[c], rhs.peak[c]);
+    }
+    return *this;
+  }
+};
+
+// raises peaks[c] to the largest magnitude of channel c over whole frames;
+// magnitudes are taken in the accumulator, where the most negative sample fits
+template<int Channels, typename T>
+void frame_peaks(const T* samples, std::size_t frames, typename sample_traits<T>::accumulator* peaks){
+  typedef typename sample_traits<T>::accumulator accumulator;
+  for(std::size_t frame = 0; frame < frames; ++frame, samples += Channels){
+    for(int c = 0; c < Channels; ++c){
+      accumulator value = (accumulator)samples[c];
+      peaks[c] = std::max(peaks[c], value < 0 ? -value : value);
+    }
+  }
+}
+
+// adds the square of every sample to sums[i % channels]; with two channels
+// count must be a whole number of frames
+template<typename T>
+void sum_of_squares_scalar(const T* samples, std::size_t count, int channels, typename square_accumulator<T>::type* sums){
+  typedef typename square_accumulator<T>::type accumulator;
+  for(std::size_t i = 0; i < count; ++i){
+    sums[i % channels] += (accumulator)samples[i] * samples[i];
+  }
+}
+
+template<typename T>
+void sum_of_squares(const T* samples, std::size_t count, int channels, typename square_accumulator<T>::type* sums){
+  sum_of_squares_scalar(samples, count, channels, sums);
+}
+
+enum class fade_curve{
+  linear,
+  exponential,  // linear in decibels over a 60 dB range
+  equal_power   // sine and cosine quarter waves, constant power across a crossfade
+};
+
+// A gain ramp from one level to another over length frames starting at frame
+// start. The quiet end lands on the outermost frame, so a fade in starts at
+// exactly from and a fade out finishes at exactly to.
+struct envelope{
+  std::size_t start;
+  std::size_t length;
+  float from;
+  float to;
+  fade_curve curve;
+};
+
+// Writes the gains of count frames starting step frames into the envelope.
+// The shape is evaluated exactly at the first frame and stepped by a
+// recurrence after that, so a tile costs one transcendental call.
+inline void envelope_gains(const envelope& ramp, std::size_t step, std::size_t count, float* gains){
+  bool rising = ramp.to >= ramp.from;
+  double low = rising ? ramp.from : ramp.to;
+  double span = rising ? ramp.to - ramp.from : ramp.from - ramp.to;
+  double dt = (rising ? 1.0 : -1.0) / ramp.length;
+  double t = rising ? (double)step / ramp.length : 1 - (double)(step + 1) / ramp.length;
+  switch(ramp.curve){
+    case fade_curve::exponential:{
+      double power = std::pow(1000.0, t), ratio = std::pow(1000.0, dt);
+      for(std::size_t k = 0; k < count; ++k, power *= ratio){
+        gains[k] = (float)(low + span * (power - 1) / 999.0);
+      }
+      break;
+    }
+    case fade_curve::equal_power:{
+      double angle = t * 1.5707963267948966, delta = dt * 1.5707963267948966;
+      double sine = std::sin(angle), cosine = std::cos(angle);
+      double step_sine = std::sin(delta), step_cosine = std::cos(delta);
+      for(std::size_t k = 0; k < count; ++k){
+        gains[k] = (float)(low + span * sine);
+        double next_sine = sine * step_cosine + cosine * step_sine;
+        cosine = cosine * step_cosine - sine * step_sine;
+        sine = next_sine;
+      }
+      break;
+    }
+    default:
+      for(std::size_t k = 0; k < count; ++k){
+        gains[k] = (float)(low + span * (t + k * dt));
+      }
+  }
+}
+
+// Gains of count frames starting step frames into an equal-power crossfade
+// of length frames. The angle is taken at frame midpoints, so the two gains
+// always have unit power and the fade is symmetric; like envelope_gains it is
+// evaluated exactly at the first frame and stepped by rotation after that.
+inline void crossfade_gains(std::size_t step, std::size_t length, std::size_t count, float* fade_out, float* fade_in){
+  double delta = 1.5707963267948966 / length, angle = (step + 0.5) * delta;
+  double sine = std::sin(angle), cosine = std::cos(angle);
+  double step_sine = std::sin(delta), step_cosine = std::cos(delta);
+  for(std::size_t k = 0; k < count; ++k){
+    fade_out[k] = (float)cosine;
+    fade_in[k] = (float)sine;
+    double next_sine = sine * step_cosine + cosine * step_sine;
+    cosine = cosine * step_cosine - sine * step_sine;
+    sine = next_sine;
+  }
+}
+
+// out = from * fade_out + to * fade_in over count interleaved frames, step
+// frames into a crossfade of length frames, saturated once per sample
+template<typename T>
+void crossfade(const T* from, const T* to, T* out, std::size_t count, int channels, std::size_t step, std::size_t length){
+  typedef typename sample_traits<T>::product product;
+  const std::size_t tile = 256;
+  float fade_out[tile], fade_in[tile];
+  for(std::size_t done = 0; done < count; done += tile){
+    std::size_t frames = std::min(tile, count - done);
+    crossfade_gains(step + done, length, frames, fade_out, fade_in);
+    for(std::size_t f = 0; f < frames; ++f){
+      for(int c = 0; c < channels; ++c){
+        std::size_t k = (done + f) * channels + c;
+        out[k] = sample_traits<T>::from_product((product)from[k] * fade_out[f] + (product)to[k] * fade_in[f]);
+      }
+    }
+  }
+}
+
+// multiplies each sample by its own gain, rounding and clamping as its sample_traits say
+template<typename T>
+void apply_gains_scalar(T* samples, const float* gains, std::size_t count){
+  for(std::size_t i = 0; i < count; ++i){
+    samples[i] = scale(samples[i], gains[i]);
+  }
+}
+
+template<typename T>
+void apply_gains(T* samples, const float* gains, std::size_t count){
+  apply_gains_scalar(samples, gains, count);
+}
+
+#ifdef __SSE2__
+
+inline void saturating_add_sse2(const int8_t* lhs, const int8_t* rhs, int8_t* out, std::size_t n){
+  const std::size_t step = sample_traits<int8_t>::lanes;
+  std::size_t i = 0;
+  for(; i + step <= n; i += step){
+    __m128i a = _mm_loadu_si128((const __m128i*)(lhs + i));
+    __m128i b = _mm_loadu_si128((const __m128i*)(rhs + i));
+    _mm_storeu_si128((__m128i*)(out + i), _mm_adds_epi8(a, b));
+  }
+  saturating_add_scalar(lhs + i, rhs + i, out + i, n - i);
+}
+
+inline void saturating_add_sse2(const int16_t* lhs, const int16_t* rhs, int16_t* out, std::size_t n){
+  const std::size_t step = sample_traits<int16_t>::lanes;
+  std::size_t i = 0;
+  for(; i + step <= n; i += step){
+    __m128i a = _mm_loadu_si128((const __m128i*)(lhs + i));
+    __m128i b = _mm_loadu_si128((const __m128i*)(rhs + i));
+    _mm_storeu_si128((__m128i*)(out + i), _mm_adds_epi16(a, b));
+  }
+  saturating_add_scalar(lhs + i, rhs + i, out + i, n - i);
+}
+
+// SSE2 has no saturating 32-bit add, so overflowing lanes are detected from
+// the sign bits and replaced with the bound matching the sign of lhs
+inline void saturating_add_sse2(const int32_t* lhs, const int32_t* rhs, int32_t* out, std::size_t n){
+  const __m128i max = _mm_set1_epi32(std::numeric_limits<int32_t>::max());
+  const std::size_t step = sample_traits<int32_t>::lanes;
+  std::size_t i = 0;
+  for(; i + step <= n; i += step){
+    __m128i a = _mm_loadu_si128((const __m128i*)(lhs + i));
+    __m128i b = _mm_loadu_si128((const __m128i*)(rhs + i));
+    __m128i sum = _mm_add_epi32(a, b);
+    __m128i overflow = _mm_srai_epi32(_mm_and_si128(_mm_xor_si128(a, sum), _mm_xor_si128(b, sum)), 31);
+    __m128i bound = _mm_xor_si128(_mm_srai_epi32(a, 31), max);
+    _mm_storeu_si128((__m128i*)(out + i),
+                     _mm_or_si128(_mm_and_si128(overflow, bound), _mm_andnot_si128(overflow, sum)));
+  }
+  saturating_add_scalar(lhs + i, rhs + i, out + i, n - i);
+}
+
+// Squares of 16 bit pairs come from pmaddwd. For stereo each pair is a left
+// and right sample, so one operand is masked down to a single channel to keep
+// the two apart. The 32 bit lane results are widened as unsigned, since two
+// squares of -32768 fill all 32 bits, and summed in 64 bit lanes.
+inline void accumulate_squares_epi16(__m128i values, int channels, __m128i* first, __m128i* second){
+  const __m128i zero = _mm_setzero_si128();
+  if(channels == 1){
+    __m128i squares = _mm_madd_epi16(values, values);
+    *first = _mm_add_epi64(*first, _mm_unpacklo_epi32(squares, zero));
+    *first = _mm_add_epi64(*first, _mm_unpackhi_epi32(squares, zero));
+    return;
+  }
+  const __m128i left_mask = _mm_set1_epi32(0x0000ffff);
+  __m128i left = _mm_madd_epi16(values, _mm_and_si128(values, left_mask));
+  __m128i right = _mm_madd_epi16(values, _mm_andnot_si128(left_mask, values));
+  *first = _mm_add_epi64(*first, _mm_unpacklo_epi32(left, zero));
+  *first = _mm_add_epi64(*first, _mm_unpackhi_epi32(left, zero));
+  *second = _mm_add_epi64(*second, _mm_unpacklo_epi32(right, zero));
+  *second = _mm_add_epi64(*second, _mm_unpackhi_epi32(right, zero));
+}
+
+inline int64_t horizontal_sum_epi64(__m128i lanes){
+  int64_t values[2];
+  _mm_storeu_si128((__m128i*)values, lanes);
+  return values[0] + values[1];
+}
+
+inline void sum_of_squares_sse2(const int16_t* samples, std::size_t count, int channels, int64_t* sums){
+  __m128i first = _mm_setzero_si128(), second = _mm_setzero_si128();
+  const std::size_t step = sample_traits<int16_t>::lanes;
+  std::size_t i = 0;
+  for(; i + step <= count; i += step){
+    accumulate_squares_epi16(_mm_loadu_si128((const __m128i*)(samples + i)), channels, &first, &second);
+  }
+  sums[0] += horizontal_sum_epi64(first);
+  sums[channels - 1] += horizontal_sum_epi64(second);
+  sum_of_squares_scalar(samples + i, count - i, channels, sums);
+}
+
+inline void sum_of_squares_sse2(const int8_t* samples, std::size_t count, int channels, int64_t* sums){
+  __m128i first = _mm_setzero_si128(), second = _mm_setzero_si128();
+  const std::size_t step = sample_traits<int8_t>::lanes;
+  std::size_t i = 0;
+  for(; i + step <= count; i += step){
+    __m128i values = _mm_loadu_si128((const __m128i*)(samples + i));
+    accumulate_squares_epi16(_mm_srai_epi16(_mm_unpacklo_epi8(values, values), 8), channels, &first, &second);
+    accumulate_squares_epi16(_mm_srai_epi16(_mm_unpackhi_epi8(values, values), 8), channels, &first, &second);
+  }
+  sums[0] += horizontal_sum_epi64(first);
+  sums[channels - 1] += horizontal_sum_epi64(second);
+  sum_of_squares_scalar(samples + i, count - i, channels, sums);
+}
+
+// 32 bit samples are converted two at a time to double lanes; for stereo
+// lane 0 then only ever sees left samples and lane 1 right ones
+inline void sum_of_squares_sse2(const int32_t* samples, std::size_t count, int channels, double* sums){
+  __m128d even = _mm_setzero_pd(), odd = _mm_setzero_pd();
+  const std::size_t step = sample_traits<int32_t>::lanes;
+  std::size_t i = 0;
+  for(; i + step <= count; i += step){
+    __m128i values = _mm_loadu_si128((const __m128i*)(samples + i));
+    __m128d low = _mm_cvtepi32_pd(values);
+    __m128d high = _mm_cvtepi32_pd(_mm_shuffle_epi32(values, _MM_SHUFFLE(1, 0, 3, 2)));
+    even = _mm_add_pd(even, _mm_mul_pd(low, low));
+    odd = _mm_add_pd(odd, _mm_mul_pd(high, high));
+  }
+  double lanes[2];
+  _mm_storeu_pd(lanes, _mm_add_pd(even, odd));
+  if(channels == 1){
+    sums[0] += lanes[0] + lanes[1];
+  }
+  else{
+    sums[0] += lanes[0];
+    sums[1] += lanes[1];
+  }
+  sum_of_squares_scalar(samples + i, count - i, channels, sums);
+}
+
+static_assert(sample_traits<int8_t>::round_mode == rounding::nearest && sample_traits<int16_t>::round_mode == rounding::nearest,
+              "the vector gain kernels convert with cvtps, so they round like from_product");
+
+// products are clamped to the int16 range in float and those that are not
+// finite are zeroed, as from_product does, so the conversion never overflows
+inline __m128 clamp_product(__m128 product){
+  const __m128 lowest = _mm_set1_ps(-32768.0f), highest = _mm_set1_ps(32767.0f);
+  const __m128 magnitude = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+  const __m128 infinity = _mm_set1_ps(std::numeric_limits<float>::infinity());
+  __m128 finite = _mm_cmplt_ps(_mm_and_ps(product, magnitude), infinity);
+  return _mm_and_ps(_mm_min_ps(_mm_max_ps(product, lowest), highest), finite);
+}
+
+inline __m128i scale_epi16(__m128i values, const float* gains){
+  __m128i low = _mm_srai_epi32(_mm_unpacklo_epi16(values, values), 16);
+  __m128i high = _mm_srai_epi32(_mm_unpackhi_epi16(values, values), 16);
+  __m128 low_product = _mm_mul_ps(_mm_cvtepi32_ps(low), _mm_loadu_ps(gains));
+  __m128 high_product = _mm_mul_ps(_mm_cvtepi32_ps(high), _mm_loadu_ps(gains + 4));
+  low = _mm_cvtps_epi32(clamp_product(low_product));
+  high = _mm_cvtps_epi32(clamp_product(high_product));
+  return _mm_packs_epi32(low, high);
+}
+
+inline void apply_gains_sse2(int16_t* samples, const float* gains, std::size_t count){
+  const std::size_t step = sample_traits<int16_t>::lanes;
+  std::size_t i = 0;
+  for(; i + step <= count; i += step){
+    __m128i values = _mm_loadu_si128((const __m128i*)(samples + i));
+    _mm_storeu_si128((__m128i*)(samples + i), scale_epi16(values, gains + i));
+  }
+  apply_gains_scalar(samples + i, gains + i, count - i);
+}
+
+inline void apply_gains_sse2(int8_t* samples, const float* gains, std::size_t count){
+  const std::size_t step = sample_traits<int8_t>::lanes;
+  std::size_t i = 0;
+  for(; i + step <= count; i += step){
+    __m128i values = _mm_loadu_si128((const __m128i*)(samples + i));
+    __m128i low = scale_epi16(_mm_srai_epi16(_mm_unpacklo_epi8(values, values), 8), gains + i);
+    __m128i high = scale_epi16(_mm_srai_epi16(_mm_unpackhi_epi8(values, values), 8), gains + i + 8);
+    _mm_storeu_si128((__m128i*)(samples + i), _mm_packs_epi16(low, high));
+  }
+  apply_gains_scalar(samples + i, gains + i, count - i);
+}
+
+#endif
+
+#ifdef AUDIO_KERNELS_DISPATCH
+
+// The wider variants compute exactly what the SSE2 ones do, lane for lane,
+// and hand their tails down to them, so every level gives the same result.
+
+#define AUDIO_TARGET_AVX2 __attribute__((target("avx2")))
+#define AUDIO_TARGET_AVX512 __attribute__((target("avx512f,avx512bw")))
+
+AUDIO_TARGET_AVX2 inline void saturating_add_avx2(const int8_t* lhs, const int8_t* rhs, int8_t* out, std::size_t n){
+  const std::size_t step = 2 * sample_traits<int8_t>::lanes;
+  std::size_t i = 0;
+  for(; i + step <= n; i += step){
+    __m256i a = _mm256_loadu_si256((const __m256i*)(lhs + i));
+    __m256i b = _mm256_loadu_si256((const __m256i*)(rhs + i));
+    _mm256_storeu_si256((__m256i*)(out + i), _mm256_adds_epi8(a, b));
+  }
+  saturating_add_sse2(lhs + i, rhs + i, out + i, n - i);
+}
+
+AUDIO_TARGET_AVX2 inline void saturating_add_avx2(const int16_t* lhs, const int16_t* rhs, int16_t* out, std::size_t n){
+  const std::size_t step = 2 * sample_traits<int16_t>::lanes;
+  std::size_t i = 0;
+  for(; i + step <= n; i += step){
+    __m256i a = _mm256_loadu_si256((const __m256i*)(lhs + i));
+    __m256i b = _mm256_loadu_si256((const __m256i*)(rhs + i));
+    _mm256_storeu_si256((__m256i*)(out + i), _mm256_adds_epi16(a, b));
+  }
+  saturating_add_sse2(lhs + i, rhs + i, out + i, n - i);
+}
+
+AUDIO_TARGET_AVX2 inline void saturating_add_avx2(const int32_t* lhs, const int32_t* rhs, int32_t* out, std::size_t n){
+  const __m256i max = _mm256_set1_epi32(std::numeric_limits<int32_t>::max());
+  const std::size_t step = 2 * sample_traits<int32_t>::lanes;
+  std::size_t i = 0;
+  for(; i + step <= n; i += step){
+    __m256i a = _mm256_loadu_si256((const __m256i*)(lhs + i));
+    __m256i b = _mm256_loadu_si256((const __m256i*)(rhs + i));
+    __m256i sum = _mm256_add_epi32(a, b);
+    __m256i overflow = _mm256_srai_epi32(_mm256_and_si256(_mm256_xor_si256(a, sum), _mm256_xor_si256(b, sum)), 31);
+    __m256i bound = _mm256_xor_si256(_mm256_srai_epi32(a, 31), max);
+    _mm256_storeu_si256((__m256i*)(out + i), _mm256_blendv_epi8(sum, bound, overflow));
+  }
+  saturating_add_sse2(lhs + i, rhs + i, out + i, n - i);
+}
+
+AUDIO_TARGET_AVX2 inline void accumulate_squares_avx2(__m256i values, int channels, __m256i* first, __m256i* second){
+  const __m256i zero = _mm256_setzero_si256();
+  if(channels == 1){
+    __m256i squares = _mm256_madd_epi16(values, values);
+    *first = _mm256_add_epi64(*first, _mm256_unpacklo_epi32(squares, zero));
+    *first = _mm256_add_epi64(*first, _mm256_unpackhi_epi32(squares, zero));
+    return;
+  }
+  const __m256i left_mask = _mm256_set1_epi32(0x0000ffff);
+  __m256i left = _mm256_madd_epi16(values, _mm256_and_si256(values, left_mask));
+  __m256i right = _mm256_madd_epi16(values, _mm256_andnot_si256(left_mask, values));
+  *first = _mm256_add_epi64(*first, _mm256_unpacklo_epi32(left, zero));
+  *first = _mm256_add_epi64(*first, _mm256_unpackhi_epi32(left, zero));
+  *second = _mm256_add_epi64(*second, _mm256_unpacklo_epi32(right, zero));
+  *second = _mm256_add_epi64(*second, _mm256_unpackhi_epi32(right, zero));
+}
+
+AUDIO_TARGET_AVX2 inline int64_t horizontal_sum_avx2(__m256i lanes){
+  int64_t values[4];
+  _mm256_storeu_si256((__m256i*)values, lanes);
+  return values[0] + values[1] + values[2] + values[3];
+}
+
+AUDIO_TARGET_AVX2 inline void sum_of_squares_avx2(const int16_t* samples, std::size_t count, int channels, int64_t* sums){
+  __m256i first = _mm256_setzero_si256(), second = _mm256_setzero_si256();
+  const std::size_t step = 2 * sample_traits<int16_t>::lanes;
+  std::size_t i = 0;
+  for(; i + step <= count; i += step){
+    accumulate_squares_avx2(_mm256_loadu_si256((const __m256i*)(samples + i)), channels, &first, &second);
+  }
+  sums[0] += horizontal_sum_avx2(first);
+  sums[channels - 1] += horizontal_sum_avx2(second);
+  sum_of_squares_sse2(samples + i, count - i, channels, sums);
+}
+
+AUDIO_TARGET_AVX2 inline void sum_of_squares_avx2(const int8_t* samples, std::size_t count, int channels, int64_t* sums){
+  __m256i first = _mm256_setzero_si256(), second = _mm256_setzero_si256();
+  const std::size_t step = 2 * sample_traits<int8_t>::lanes;
+  std::size_t i = 0;
+  for(; i + step <= count; i += step){
+    __m256i values = _mm256_loadu_si256((const __m256i*)(samples + i));
+    accumulate_squares_avx2(_mm256_cvtepi8_epi16(_mm256_castsi256_si128(values)), channels, &first, &second);
+    accumulate_squares_avx2(_mm256_cvtepi8_epi16(_mm256_extracti128_si256(values, 1)), channels, &first, &second);
+  }
+  sums[0] += horizontal_sum_avx2(first);
+  sums[channels - 1] += horizontal_sum_avx2(second);
+  sum_of_squares_sse2(samples + i, count - i, channels, sums);
+}
+
+// packs_epi32 works within 128 bit halves, so the 64 bit quarters are put
+// back in order afterwards
+AUDIO_TARGET_AVX2 inline __m256 clamp_product_avx2(__m256 product){
+  const __m256 lowest = _mm256_set1_ps(-32768.0f), highest = _mm256_set1_ps(32767.0f);
+  const __m256 magnitude = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+  const __m256 infinity = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+  __m256 finite = _mm256_cmp_ps(_mm256_and_ps(product, magnitude), infinity, _CMP_LT_OQ);
+  return _mm256_and_ps(_mm256_min_ps(_mm256_max_ps(product, lowest), highest), finite);
+}
+
+AUDIO_TARGET_AVX2 inline __m256i scale_epi16_avx2(__m256i values, const float* gains){
+  __m256i low = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(values));
+  __m256i high = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(values, 1));
+  __m256 low_product = _mm256_mul_ps(_mm256_cvtepi32_ps(low), _mm256_loadu_ps(gains));
+  __m256 high_product = _mm256_mul_ps(_mm256_cvtepi32_ps(high), _mm256_loadu_ps(gains + 8));
+  low = _mm256_cvtps_epi32(clamp_product_avx2(low_product));
+  high = _mm256_cvtps_epi32(clamp_product_avx2(high_product));
+  return _mm256_permute4x64_epi64(_mm256_packs_epi32(low, high), _MM_SHUFFLE(3, 1, 2, 0));
+}
+
+AUDIO_TARGET_AVX2 inline void apply_gains_avx2(int16_t* samples, const float* gains, std::size_t count){
+  const std::size_t step = 2 * sample_traits<int16_t>::lanes;
+  std::size_t i = 0;
+  for(; i + step <= count; i += step){
+    __m256i values = _mm256_loadu_si256((const __m256i*)(samples + i));
+    _mm256_storeu_si256((__m256i*)(samples + i), scale_epi16_avx2(values, gains + i));
+  }
+  apply_gains_sse2(samples + i, gains + i, count - i);
+}
+
+AUDIO_TARGET_AVX2 inline void apply_gains_avx2(int8_t* samples, const float* gains, std::size_t count){
+  const std::size_t step = 2 * sample_traits<int8_t>::lanes;
+  std::size_t i = 0;
+  for(; i + step <= count; i += step){
+    __m256i values = _mm256_loadu_si256((const __m256i*)(samples + i));
+    __m256i low = scale_epi16_avx2(_mm256_cvtepi8_epi16(_mm256_castsi256_si128(values)), gains + i);
+    __m256i high = scale_epi16_avx2(_mm256_cvtepi8_epi16(_mm256_extracti128_si256(values, 1)), gains + i + 16);
+    _mm256_storeu_si256((__m256i*)(samples + i),
+                        _mm256_permute4x64_epi64(_mm256_packs_epi16(low, high), _MM_SHUFFLE(3, 1, 2, 0)));
+  }
+  apply_gains_sse2(samples + i, gains + i, count - i);
+}
+
+AUDIO_TARGET_AVX512 inline void saturating_add_avx512(const int8_t* lhs, const int8_t* rhs, int8_t* out, std::size_t n){
+  const std::size_t step = 4 * sample_traits<int8_t>::lanes;
+  std::size_t i = 0;
+  for(; i + step <= n; i += step){
+    __m512i a = _mm512_loadu_si512(lhs + i);
+    __m512i b = _mm512_loadu_si512(rhs + i);
+    _mm512_storeu_si512(out + i, _mm512_adds_epi8(a, b));
+  }
+  saturating_add_avx2(lhs + i, rhs + i, out + i, n - i);
+}
+
+AUDIO_TARGET_AVX512 inline void saturating_add_avx512(const int16_t* lhs, const int16_t* rhs, int16_t* out, std::size_t n){
+  const std::size_t step = 4 * sample_traits<int16_t>::lanes;
+  std::size_t i = 0;
+  for(; i + step <= n; i += step){
+    __m512i a = _mm512_loadu_si512(lhs + i);
+    __m512i b = _mm512_loadu_si512(rhs + i);
+    _mm512_storeu_si512(out + i, _mm512_adds_epi16(a, b));
+  }
+  saturating_add_avx2(lhs + i, rhs + i, out + i, n - i);
+}
+
+// the overflow test of the SSE2 kernel, as a lane mask
+AUDIO_TARGET_AVX512 inline void saturating_add_avx512(const int32_t* lhs, const int32_t* rhs, int32_t* out, std::size_t n){
+  const __m512i max = _mm512_set1_epi32(std::numeric_limits<int32_t>::max());
+  const std::size_t step = 4 * sample_traits<int32_t>::lanes;
+  std::size_t i = 0;
+  for(; i + step <= n; i += step){
+    __m512i a = _mm512_loadu_si512(lhs + i);
+    __m512i b = _mm512_loadu_si512(rhs + i);
+    __m512i sum = _mm512_add_epi32(a, b);
+    __mmask16 overflow = _mm512_cmplt_epi32_mask(_mm512_and_si512(_mm512_xor_si512(a, sum), _mm512_xor_si512(b, sum)),
+                                                 _mm512_setzero_si512());
+    __m512i bound = _mm512_xor_si512(_mm512_srai_epi32(a, 31), max);
+    _mm512_storeu_si512(out + i, _mm512_mask_blend_epi32(overflow, sum, bound));
+  }
+  saturating_add_avx2(lhs + i, rhs + i, out + i, n - i);
+}
+
+AUDIO_TARGET_AVX512 inline void sum_of_squares_avx512(const int16_t* samples, std::size_t count, int channels, int64_t* sums){
+  const __m512i zero = _mm512_setzero_si512();
+  const __m512i left_mask = _mm512_set1_epi32(channels == 1 ? -1 : 0x0000ffff);
+  __m512i first = zero, second = zero;
+  const std::size_t step = 4 * sample_traits<int16_t>::lanes;
+  std::size_t i = 0;
+  for(; i + step <= count; i += step){
+    __m512i values = _mm512_loadu_si512(samples + i);
+    __m512i left = _mm512_madd_epi16(values, _mm512_and_si512(values, left_mask));
+    __m512i right = _mm512_madd_epi16(values, _mm512_andnot_si512(left_mask, values));
+    first = _mm512_add_epi64(first, _mm512_unpacklo_epi32(left, zero));
+    first = _mm512_add_epi64(first, _mm512_unpackhi_epi32(left, zero));
+    second = _mm512_add_epi64(second, _mm512_unpacklo_epi32(right, zero));
+    second = _mm512_add_epi64(second, _mm512_unpackhi_epi32(right, zero));
+  }
+  sums[0] += _mm512_reduce_add_epi64(first);
+  sums[channels - 1] += _mm512_reduce_add_epi64(second);
+  sum_of_squares_avx2(samples + i, count - i, channels, sums);
+}
+
+AUDIO_TARGET_AVX512 inline void apply_gains_avx512(int16_t* samples, const float* gains, std::size_t count){
+  const std::size_t step = 2 * sample_traits<int16_t>::lanes;
+  std::size_t i = 0;
+  const __m512 lowest = _mm512_set1_ps(-32768.0f), highest = _mm512_set1_ps(32767.0f);
+  const __m512 infinity = _mm512_set1_ps(std::numeric_limits<float>::infinity());
+  for(; i + step <= count; i += step){
+    __m512i values = _mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i*)(samples + i)));
+    __m512 product = _mm512_mul_ps(_mm512_cvtepi32_ps(values), _mm512_loadu_ps(gains + i));
+    __mmask16 finite = _mm512_cmp_ps_mask(_mm512_abs_ps(product), infinity, _CMP_LT_OQ);
+    __m512 clamped = _mm512_maskz_mov_ps(finite, _mm512_min_ps(_mm512_max_ps(product, lowest), highest));
+    __m512i scaled = _mm512_cvtps_epi32(clamped);
+    _mm256_storeu_si256((__m256i*)(samples + i), _mm512_cvtsepi32_epi16(scaled));
+  }
+  apply_gains_avx2(samples + i, gains + i, count - i);
+}
+
+#endif
+
+#ifdef __SSE2__
+
+// The entry points used by audio.h, one switch per call on active_isa().
+// Levels without a variant of their own fall through to the next one down.
+
+inline void saturating_add(const int8_t* lhs, const int8_t* rhs, int8_t* out, std::size_t n){
+  switch(active_isa()){
+#ifdef AUDIO_KERNELS_DISPATCH
+    case isa::avx512: saturating_add_avx512(lhs, rhs, out, n); return;
+    case isa::avx2: saturating_add_avx2(lhs, rhs, out, n); return;
+#endif
+    case isa::scalar: saturating_add_scalar(lhs, rhs, out, n); return;
+    default: saturating_add_sse2(lhs, rhs, out, n);
+  }
+}
+
+inline void saturating_add(const int16_t* lhs, const int16_t* rhs, int16_t* out, std::size_t n){
+  switch(active_isa()){
+#ifdef AUDIO_KERNELS_DISPATCH
+    case isa::avx512: saturating_add_avx512(lhs, rhs, out, n); return;
+    case isa::avx2: saturating_add_avx2(lhs, rhs, out, n); return;
+#endif
+    case isa::scalar: saturating_add_scalar(lhs, rhs, out, n); return;
+    default: saturating_add_sse2(lhs, rhs, out, n);
+  }
+}
+
+inline void saturating_add(const int32_t* lhs, const int32_t* rhs, int32_t* out, std::size_t n){
+  switch(active_isa()){
+#ifdef AUDIO_KERNELS_DISPATCH
+    case isa::avx512: saturating_add_avx512(lhs, rhs, out, n); return;
+    case isa::avx2: saturating_add_avx2(lhs, rhs, out, n); return;
+#endif
+    case isa::scalar: saturating_add_scalar(lhs, rhs, out, n); return;
+    default: saturating_add_sse2(lhs, rhs, out, n);
+  }
+}
+
+inline void sum_of_squares(const int16_t* samples, std::size_t count, int channels, int64_t* sums){
+  switch(active_isa()){
+#ifdef AUDIO_KERNELS_DISPATCH
+    case isa::avx512: sum_of_squares_avx512(samples, count, channels, sums); return;
+    case isa::avx2: sum_of_squares_avx2(samples, count, channels, sums); return;
+#endif
+    case isa::scalar: sum_of_squares_scalar(samples, count, channels, sums); return;
+    default: sum_of_squares_sse2(samples, count, channels, sums);
+  }
+}
+
+inline void sum_of_squares(const int8_t* samples, std::size_t count, int channels, int64_t* sums){
+  switch(active_isa()){
+#ifdef AUDIO_KERNELS_DISPATCH
+    case isa::avx512:
+    case isa::avx2: sum_of_squares_avx2(samples, count, channels, sums); return;
+#endif
+    case isa::scalar: sum_of_squares_scalar(samples, count, channels, sums); return;
+    default: sum_of_squares_sse2(samples, count, channels, sums);
+  }
+}
+
+// sums in double, so it keeps a single vector variant: wider ones would add
+// in a different order and change the last bits between hosts
+inline void sum_of_squares(const int32_t* samples, std::size_t count, int channels, double* sums){
+  if(active_isa() == isa::scalar){
+    sum_of_squares_scalar(samples, count, channels, sums);
+  }
+  else{
+    sum_of_squares_sse2(samples, count, channels, sums);
+  }
+}
+
+inline void apply_gains(int16_t* samples, const float* gains, std::size_t count){
+  switch(active_isa()){
+#ifdef AUDIO_KERNELS_DISPATCH
+    case isa::avx512: apply_gains_avx512(samples, gains, count); return;
+    case isa::avx2: apply_gains_avx2(samples, gains, count); return;
+#endif
+    case isa::scalar: apply_gains_scalar(samples, gains, count); return;
+    default: apply_gains_sse2(samples, gains, count);
+  }
+}
+
+inline void apply_gains(int8_t* samples, const float* gains, std::size_t count){
+  switch(active_isa()){
+#ifdef AUDIO_KERNELS_DISPATCH
+    case isa::avx512:
+    case isa::avx2: apply_gains_avx2(samples, gains, count); return;
+#endif
+    case isa::scalar: apply_gains_scalar(samples, gains, count); return;
+    default: apply_gains_sse2(samples, gains, count);
+  }
+}
+
+#endif
+
+// Sums of squares per channel over whole frames. One and two channels use
+// the vector kernels; wider frames take a loop over the channels whose bound
+// is a compile time constant, so it is unrolled.
+template<int Channels, typename T>
+void frame_sum_of_squares(const T* samples, std::size_t frames, typename square_accumulator<T>::type* sums){
+  typedef typename square_accumulator<T>::type accumulator;
+  if(Channels <= 2){
+    sum_of_squares(samples, frames * Channels, Channels, sums);
+    return;
+  }
+  for(std::size_t frame = 0; frame < frames; ++frame, samples += Channels){
+    for(int c = 0; c < Channels; ++c){
+      sums[c] += (accumulator)samples[c] * samples[c];
+    }
+  }
+}
+
+// Applies ramp to the interleaved frames [first_frame, first_frame + frames)
+// held in samples; only frames inside the envelope are touched. Gains are
+// built a tile at a time and applied by the vector kernel in the same pass.
+template<typename T>
+void apply_envelope(T* samples, std::size_t frames, int channels, const envelope& ramp, std::size_t first_frame = 0){
+  const std::size_t tile = 256;
+  float frame_gains[tile], gains[2 * tile];
+  std::size_t begin = std::max(ramp.start, first_frame);
+  std::size_t end = std::min(ramp.start + ramp.length, first_frame + frames);
+  // frames whose expanded gains fit the buffer
+  std::size_t block = std::max<std::size_t>(1, 2 * tile / channels);
+  for(std::size_t frame = begin; frame < end; frame += tile){
+    std::size_t count = std::min(tile, end - frame);
+    envelope_gains(ramp, frame - ramp.start, count, frame_gains);
+    for(std::size_t f = 0; f < count; f += block){
+      std::size_t n = std::min(block, count - f);
+      T* out = samples + (frame + f - first_frame) * channels;
+      if(n * channels > 2 * tile){
+        for(int c = 0; c < channels; ++c){
+          out[c] = scale(out[c], frame_gains[f]);
+        }
+        continue;
+      }
+      for(std::size_t k = 0; k < n * channels; ++k){
+        gains[k] = frame_gains[f + k / channels];
+      }
+      apply_gains(out, gains, n * channels);
+    }
+  }
+}
+
+// Multiplies count interleaved samples by one gain per channel through the
+// dispatched gain kernel. phase is the channel of the first sample, so chunks
+// may start anywhere in a frame.
+template<typename T>
+void apply_channel_gains(T* samples, std::size_t count, int channels, const float* gain, std::size_t phase = 0){
+  const std::size_t tile = 512;
+  if((std::size_t)channels > tile){
+    for(std::size_t i = 0; i < count; ++i){
+      samples[i] = scale(samples[i], gain[(phase + i) % channels]);
+    }
+    return;
+  }
+  // whole frames per tile, plus one frame so any phase can start the pattern
+  float gains[2 * tile];
+  std::size_t period = tile / channels * channels;
+  for(std::size_t k = 0; k < period + channels; ++k){
+    gains[k] = gain[k % channels];
+  }
+  const float* pattern = gains + phase % channels;
+  for(std::size_t i = 0; i < count; i += period){
+    apply_gains(samples + i, pattern, std::min(period, count - i));
+  }
+}
+
+}
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef AUDIO_MEMORY_H
+#define AUDIO_MEMORY_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#include <sys/mman.h>
+
+namespace audio_memory{
+
+const std::size_t cache_line = 64;
+const std::size_t huge_page = 1 << 21;
+
+inline std::atomic<bool>& huge_pages_enabled(){
+  static std::atomic<bool> enabled(false);
+  return enabled;
+}
+
+// buffers of at least one huge page are then backed by transparent huge pages
+inline void set_huge_pages(bool enabled){
+  huge_pages_enabled() = enabled;
+}
+
+inline bool is_aligned(const void* memory, std::size_t alignment = cache_line){
+  return reinterpret_cast<std::uintptr_t>(memory) % alignment == 0;
+}
+
+// bytes of storage starting on a cache line, or on a huge page boundary for
+// large buffers when huge pages are enabled; release with deallocate()
+inline void* allocate(std::size_t bytes){
+  bool huge = huge_pages_enabled() && bytes >= huge_page;
+  std::size_t size = huge ? (bytes + huge_page - 1) / huge_page * huge_page : (bytes ? bytes : 1);
+  void* memory = nullptr;
+  if(posix_memalign(&memory, huge ? huge_page : cache_line, size) != 0){
+    throw std::bad_alloc();
+  }
+#ifdef MADV_HUGEPAGE
+  if(huge){
+    madvise(memory, size, MADV_HUGEPAGE);
+  }
+#endif
+  return memory;
+}
+
+inline void deallocate(void* memory){
+  std::free(memory);
+}
+
+}
+
+// Allocator whose buffers start on a cache line, so SIMD kernels see aligned
+// data from the first frame. The parallel chunks and envelope tiles are whole
+// cache lines, so every block a kernel is handed starts aligned as well.
+template<typename T>
+class aligned_allocator{
+public:
+  typedef T value_type;
+
+  aligned_allocator(){}
+
+  template<typename U>
+  aligned_allocator(const aligned_allocator<U>&){}
+
+  T* allocate(std::size_t count){
+    return static_cast<T*>(audio_memory::allocate(count * sizeof(T)));
+  }
+
+  void deallocate(T* memory, std::size_t){
+    audio_memory::deallocate(memory);
+  }
+
+  template<typename U>
+  bool operator==(const aligned_allocator<U>&) const{
+    return true;
+  }
+
+  template<typename U>
+  bool operator!=(const aligned_allocator<U>&) const{
+    return false;
+  }
+};
+
+#endif
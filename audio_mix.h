@@ -0,0 +1,180 @@
+#ifndef AUDIO_MIX_H
+#define AUDIO_MIX_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "audio.h"
+
+// Mixes any number of clips into one in a single pass. T is the frame type,
+// as for audio<T>. Every track has its own gain and a frame offset into the
+// output. The output is built a tile at a time: each track adds into a wide
+// accumulator that stays in cache, and samples are rounded like from_product
+// and saturated once when the tile is stored. Integer samples are summed in
+// fixed point: every gain is rounded to gain_bits fraction bits, so each
+// product is a whole number and the sums are exact, and the result does not
+// depend on the order of the tracks. Floating point samples are summed in
+// double. Tiles are spread over the thread pool. Tracks are views, so the
+// clips must outlive the mixer.
+template<typename T>
+class audio_mixer{
+private:
+  typedef typename audio_kernels::frame_traits<T>::sample sample;
+  typedef audio_kernels::sample_traits<sample> traits;
+  static const bool fixed = !std::is_floating_point<sample>::value;
+  static const int gain_bits = 16;
+  // a product fits in 47 bits for samples of up to 16 bits and in 79 above;
+  // larger gains would saturate any sample that is not zero anyway
+  typedef typename std::conditional<!fixed, double,
+          typename std::conditional<sizeof(sample) <= 2, int64_t, __int128>::type>::type accumulator;
+  typedef typename std::conditional<fixed, int64_t, double>::type track_gain;
+  static const int channels = audio_kernels::frame_traits<T>::channels;
+  static const int slots = channels > 2 ? channels : 2;
+  static const std::size_t tile = 4096;
+
+  struct track{
+    const sample* samples;
+    std::size_t frames;
+    std::size_t offset;
+    track_gain gain[slots];
+  };
+
+  // gains that are not a number mix the track in silently
+  static track_gain to_gain(float gain){
+    if(!fixed){
+      return gain;
+    }
+    double limit = std::ldexp(1.0, sizeof(sample) <= 2 ? 31 : 47);
+    double units = std::isnan(gain) ? 0 : std::ldexp((double)gain, gain_bits);
+    return (track_gain)std::llround(std::min(std::max(units, -limit), limit));
+  }
+
+  static sample store(accumulator sum, std::true_type){
+    const accumulator unit = (accumulator)1 << gain_bits;
+    accumulator whole = sum / unit, rest = sum % unit;
+    if(rest < 0){
+      --whole;
+      rest += unit;
+    }
+    if(rest > unit / 2 || (rest == unit / 2 && (whole & 1))){
+      ++whole;
+    }
+    return traits::saturate((int64_t)std::min<accumulator>(std::max<accumulator>(whole, traits::min()), traits::max()));
+  }
+
+  static sample store(accumulator sum, std::false_type){
+    return traits::from_product(sum);
+  }
+
+  std::vector<track> tracks;
+  std::size_t length;
+  int sample_length;
+
+  static void unpack(const std::pair<float, float>& gain, float* values){
+    values[0] = gain.first;
+    values[1] = gain.second;
+  }
+
+  template<std::size_t N>
+  static void unpack(const std::array<float, N>& gain, float* values){
+    std::copy(gain.begin(), gain.end(), values);
+  }
+
+  static void unit_gain(std::pair<float, float>& gain){
+    gain = std::make_pair(1.0f, 1.0f);
+  }
+
+  template<std::size_t N>
+  static void unit_gain(std::array<float, N>& gain){
+    gain.fill(1.0f);
+  }
+
+  // mixes count frames starting at output frame first into out
+  void mix_tile(std::size_t first, std::size_t count, sample* out) const{
+    accumulator sums[tile];
+    std::fill(sums, sums + count * channels, accumulator());
+    for(const track& t : tracks){
+      std::size_t begin = std::max(first, t.offset), end = std::min(first + count, t.offset + t.frames);
+      if(begin >= end){
+        continue;
+      }
+      const sample* in = t.samples + (begin - t.offset) * channels;
+      accumulator* sum = sums + (begin - first) * channels;
+      for(std::size_t frame = begin; frame < end; ++frame, in += channels, sum += channels){
+        for(int c = 0; c < channels; ++c){
+          sum[c] += (accumulator)in[c] * t.gain[c];
+        }
+      }
+    }
+    for(std::size_t k = 0; k < count * channels; ++k){
+      out[k] = store(sums[k], std::integral_constant<bool, fixed>());
+    }
+  }
+
+public:
+  typedef typename audio_kernels::frame_traits<T>::gains gain_type;
+
+  audio_mixer(int sampl_len = 0) : length(0), sample_length(sampl_len){}
+
+  static gain_type unity(){
+    gain_type gain;
+    unit_gain(gain);
+    return gain;
+  }
+
+  // clip starts at output frame offset, scaled by gain
+  audio_mixer& add(const audio_view<T>& clip, const gain_type& gain, std::size_t offset = 0){
+    track t;
+    t.samples = reinterpret_cast<const sample*>(clip.data());
+    t.frames = clip.size();
+    t.offset = offset;
+    float values[slots];
+    unpack(gain, values);
+    std::transform(values, values + channels, t.gain, to_gain);
+    tracks.push_back(t);
+    length = std::max(length, offset + clip.size());
+    if(sample_length == 0){
+      sample_length = clip.get_sample_length();
+    }
+    return *this;
+  }
+
+  template<typename Alloc>
+  audio_mixer& add(const audio<T, Alloc>& clip, const gain_type& gain, std::size_t offset = 0){
+    return add(clip.view(), gain, offset);
+  }
+
+  template<typename Alloc>
+  audio_mixer& add(const audio<T, Alloc>& clip){
+    return add(clip.view(), unity());
+  }
+
+  std::size_t size() const{
+    return length;
+  }
+
+  std::size_t track_count() const{
+    return tracks.size();
+  }
+
+  // the mix, as long as the furthest reaching track
+  audio<T> mix() const{
+    std::vector<T> result(length);
+    sample* out = reinterpret_cast<sample*>(result.data());
+    const std::size_t tile_frames = tile / channels;
+    audio_parallel::for_each_chunk<T>(length, [&](std::size_t begin, std::size_t end){
+      for(std::size_t frame = begin; frame < end; frame += tile_frames){
+        mix_tile(frame, std::min(tile_frames, end - frame), out + frame * channels);
+      }
+    });
+    return audio<T>(std::move(result), sample_length);
+  }
+};
+
+#endif
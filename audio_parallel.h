@@ -0,0 +1,271 @@
+#ifndef AUDIO_PARALLEL_H
+#define AUDIO_PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace audio_parallel{
+
+// Runs count indexed tasks across a fixed set of workers; the calling thread
+// takes tasks too. One job runs at a time, and a job started from inside a
+// task, on a worker or on the calling thread, runs inline, so kernels can
+// nest without deadlocking. The first exception a task throws stops the
+// tasks not yet started and is rethrown from run() once every worker is done.
+class thread_pool{
+private:
+  std::vector<std::thread> workers;
+  std::mutex lock;
+  std::mutex submit;
+  std::condition_variable wake;
+  std::condition_variable idle;
+  std::function<void(std::size_t)> job;
+  std::size_t job_count;
+  std::atomic<std::size_t> next;
+  std::size_t finished;
+  std::size_t busy;
+  unsigned generation;
+  bool stop;
+  std::atomic<bool> failed;
+  std::exception_ptr failure;
+
+  static bool& inside_worker(){
+    static thread_local bool flag = false;
+    return flag;
+  }
+
+  // marks the calling thread as running tasks for as long as it submits a job
+  struct submitting{
+    submitting(){
+      inside_worker() = true;
+    }
+
+    ~submitting(){
+      inside_worker() = false;
+    }
+  };
+
+  void work(){
+    std::size_t done = 0;
+    for(std::size_t i = next++; i < job_count; i = next++){
+      if(!failed){
+        try{
+          job(i);
+        }
+        catch(...){
+          std::lock_guard<std::mutex> guard(lock);
+          if(!failure){
+            failure = std::current_exception();
+          }
+          failed = true;
+        }
+      }
+      ++done;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    finished += done;
+    if(finished == job_count){
+      idle.notify_all();
+    }
+  }
+
+  void worker_loop(){
+    inside_worker() = true;
+    unsigned seen = 0;
+    while(true){
+      {
+        std::unique_lock<std::mutex> guard(lock);
+        wake.wait(guard, [&]{ return stop || generation != seen; });
+        if(stop){
+          return;
+        }
+        seen = generation;
+        ++busy;
+      }
+      work();
+      std::lock_guard<std::mutex> guard(lock);
+      --busy;
+      idle.notify_all();
+    }
+  }
+
+public:
+  explicit thread_pool(unsigned threads)
+    : job_count(0), next(0), finished(0), busy(0), generation(0), stop(false), failed(false){
+    for(unsigned i = 1; i < threads; ++i){
+      workers.push_back(std::thread(&thread_pool::worker_loop, this));
+    }
+  }
+
+  ~thread_pool(){
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      stop = true;
+    }
+    wake.notify_all();
+    for(auto& worker : workers){
+      worker.join();
+    }
+  }
+
+  unsigned size() const{
+    return workers.size() + 1;
+  }
+
+  void run(std::size_t count, const std::function<void(std::size_t)>& task){
+    if(count == 0){
+      return;
+    }
+    if(workers.empty() || count == 1 || inside_worker()){
+      for(std::size_t i = 0; i < count; ++i){
+        task(i);
+      }
+      return;
+    }
+    std::lock_guard<std::mutex> serial(submit);
+    submitting caller;
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      idle.wait(guard, [&]{ return busy == 0; });
+      job = task;
+      job_count = count;
+      next = 0;
+      finished = 0;
+      failed = false;
+      ++generation;
+    }
+    wake.notify_all();
+    work();
+    std::exception_ptr error;
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      idle.wait(guard, [&]{ return finished == job_count && busy == 0; });
+      job = nullptr;
+      std::swap(error, failure);
+    }
+    if(error){
+      std::rethrow_exception(error);
+    }
+  }
+};
+
+// Read by every operator on any thread, so each field is atomic.
+struct settings{
+  std::atomic<unsigned> threads;
+  std::atomic<std::size_t> threshold;   // buffers below this many samples stay on the calling thread
+  std::atomic<std::size_t> chunk_bytes; // work is split into chunks of this size
+
+  settings(unsigned thread_count, std::size_t threshold_samples, std::size_t chunk_size)
+    : threads(thread_count), threshold(threshold_samples), chunk_bytes(chunk_size){}
+};
+
+inline settings& config(){
+  static settings current(std::max(1u, std::thread::hardware_concurrency()), 1 << 18, 1 << 16);
+  return current;
+}
+
+inline std::shared_ptr<thread_pool>& pool_slot(){
+  static std::shared_ptr<thread_pool> slot;
+  return slot;
+}
+
+inline std::mutex& pool_mutex(){
+  static std::mutex guard;
+  return guard;
+}
+
+// The pool for the current thread count. A resize swaps in a new pool, and
+// callers share ownership of the one they run on, so a job that is still
+// running keeps its old pool alive until it finishes.
+inline std::shared_ptr<thread_pool> pool(){
+  std::lock_guard<std::mutex> guard(pool_mutex());
+  std::shared_ptr<thread_pool>& slot = pool_slot();
+  unsigned threads = config().threads;
+  if(!slot || slot->size() != threads){
+    slot = std::make_shared<thread_pool>(threads);
+  }
+  return slot;
+}
+
+// threads = 1 makes every operator serial
+inline void set_threads(unsigned threads){
+  config().threads = std::max(1u, threads);
+}
+
+inline void set_threshold(std::size_t samples){
+  config().threshold = samples;
+}
+
+// samples per chunk: about chunk_bytes, rounded to whole 64 byte cache lines
+// so that every chunk of an aligned buffer starts aligned
+template<typename Sample>
+std::size_t chunk_samples(){
+  std::size_t line = 64, a = line, b = sizeof(Sample);
+  while(b != 0){
+    std::size_t r = a % b;
+    a = b;
+    b = r;
+  }
+  std::size_t unit = line / a;
+  return std::max(unit, config().chunk_bytes / sizeof(Sample) / unit * unit);
+}
+
+// Calls fn(begin, end) over [0, count) in chunks of chunk_bytes worth of
+// samples. Chunk boundaries depend only on count and the sample size, never on
+// the number of threads.
+template<typename Sample, typename Function>
+void for_each_chunk(std::size_t count, Function fn){
+  std::size_t grain = chunk_samples<Sample>();
+  std::size_t chunks = (count + grain - 1) / grain;
+  auto task = [&](std::size_t c){
+    fn(c * grain, std::min(count, (c + 1) * grain));
+  };
+  if(count < config().threshold || config().threads <= 1){
+    for(std::size_t c = 0; c < chunks; ++c){
+      task(c);
+    }
+    return;
+  }
+  pool()->run(chunks, task);
+}
+
+// Calls fn(task) for every task in [0, count), for work that comes in its own
+// units, such as the blocks of a compressed file.
+template<typename Function>
+void for_each_task(std::size_t count, Function fn){
+  if(count < 2 || config().threads <= 1){
+    for(std::size_t t = 0; t < count; ++t){
+      fn(t);
+    }
+    return;
+  }
+  pool()->run(count, fn);
+}
+
+// Sums fn(begin, end) over the same chunks as for_each_chunk, adding the
+// partial results in chunk order so the total is identical on any number of
+// threads.
+template<typename Sample, typename Result, typename Function>
+Result chunked_sum(std::size_t count, Function fn){
+  std::size_t grain = chunk_samples<Sample>();
+  std::vector<Result> partials((count + grain - 1) / grain, Result());
+  for_each_chunk<Sample>(count, [&](std::size_t begin, std::size_t end){
+    partials[begin / grain] = fn(begin, end);
+  });
+  Result total = Result();
+  for(const Result& partial : partials){
+    total += partial;
+  }
+  return total;
+}
+
+}
+
+#endif
@@ -0,0 +1,178 @@
+#ifndef AUDIO_PIPELINE_H
+#define AUDIO_PIPELINE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+enum class pipeline_stage{ read, process, write };
+
+// Where a pipeline spent its time. A stage is busy while it runs its own
+// function and idle while it waits on a neighbouring ring, so the stage with
+// the highest utilization is the one holding the others back.
+struct pipeline_report{
+  double seconds;
+  double busy[3];
+  std::size_t blocks;
+
+  double utilization(pipeline_stage stage) const{
+    return seconds > 0 ? busy[(int)stage] / seconds : 0;
+  }
+
+  pipeline_stage bottleneck() const{
+    int most = 0;
+    for(int s = 1; s < 3; ++s){
+      if(busy[s] > busy[most]){
+        most = s;
+      }
+    }
+    return (pipeline_stage)most;
+  }
+};
+
+// Fixed capacity queue handing items from one stage to the next. push blocks
+// while the ring is full and pop while it is empty; once closed, push fails
+// and pop drains what is left.
+template<typename Item>
+class bounded_ring{
+private:
+  std::vector<Item> slots;
+  std::size_t head;
+  std::size_t count;
+  bool closed;
+  std::mutex lock;
+  std::condition_variable not_empty;
+  std::condition_variable not_full;
+
+public:
+  explicit bounded_ring(std::size_t capacity) : slots(capacity ? capacity : 1), head(0), count(0), closed(false){}
+
+  bool push(Item&& item){
+    std::unique_lock<std::mutex> guard(lock);
+    not_full.wait(guard, [&]{ return closed || count < slots.size(); });
+    if(closed){
+      return false;
+    }
+    slots[(head + count++) % slots.size()] = std::move(item);
+    not_empty.notify_one();
+    return true;
+  }
+
+  bool pop(Item& item){
+    std::unique_lock<std::mutex> guard(lock);
+    not_empty.wait(guard, [&]{ return closed || count > 0; });
+    if(count == 0){
+      return false;
+    }
+    item = std::move(slots[head]);
+    head = (head + 1) % slots.size();
+    --count;
+    not_full.notify_one();
+    return true;
+  }
+
+  void close(){
+    std::lock_guard<std::mutex> guard(lock);
+    closed = true;
+    not_empty.notify_all();
+    not_full.notify_all();
+  }
+};
+
+// Runs read, process and write as three stages over depth items that cycle
+// reader -> processor -> writer -> reader, so at most depth blocks are in
+// memory and their buffers are reused. read(item) fills an item and returns
+// false when there is nothing left; process(item) runs on the calling thread,
+// read and write on their own. Blocks reach write in the order they were read.
+// An exception in any stage stops the others and is rethrown here.
+template<typename Item, typename Read, typename Process, typename Write>
+pipeline_report run_pipeline(std::size_t depth, Read read, Process process, Write write){
+  typedef std::chrono::steady_clock clock;
+  depth = depth ? depth : 1;
+  bounded_ring<Item> free_items(depth), filled(depth), processed(depth);
+  for(std::size_t i = 0; i < depth; ++i){
+    free_items.push(Item());
+  }
+  pipeline_report report = {0, {0, 0, 0}, 0};
+  std::exception_ptr failure;
+  std::mutex failure_lock;
+  auto fail = [&]{
+    {
+      std::lock_guard<std::mutex> guard(failure_lock);
+      if(!failure){
+        failure = std::current_exception();
+      }
+    }
+    free_items.close();
+    filled.close();
+    processed.close();
+  };
+  auto timed = [&](pipeline_stage stage, clock::time_point start){
+    report.busy[(int)stage] += std::chrono::duration<double>(clock::now() - start).count();
+  };
+  clock::time_point start = clock::now();
+
+  std::thread reader([&]{
+    try{
+      Item item;
+      while(free_items.pop(item)){
+        clock::time_point begin = clock::now();
+        bool more = read(item);
+        timed(pipeline_stage::read, begin);
+        if(!more || !filled.push(std::move(item))){
+          break;
+        }
+      }
+      filled.close();
+    }
+    catch(...){
+      fail();
+    }
+  });
+
+  std::thread writer([&]{
+    try{
+      Item item;
+      while(processed.pop(item)){
+        clock::time_point begin = clock::now();
+        write(item);
+        timed(pipeline_stage::write, begin);
+        ++report.blocks;
+        free_items.push(std::move(item));
+      }
+    }
+    catch(...){
+      fail();
+    }
+  });
+
+  try{
+    Item item;
+    while(filled.pop(item)){
+      clock::time_point begin = clock::now();
+      process(item);
+      timed(pipeline_stage::process, begin);
+      if(!processed.push(std::move(item))){
+        break;
+      }
+    }
+    processed.close();
+  }
+  catch(...){
+    fail();
+  }
+  reader.join();
+  writer.join();
+  report.seconds = std::chrono::duration<double>(clock::now() - start).count();
+  if(failure){
+    std::rethrow_exception(failure);
+  }
+  return report;
+}
+
+#endif
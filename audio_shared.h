@@ -0,0 +1,134 @@
+#ifndef AUDIO_SHARED_H
+#define AUDIO_SHARED_H
+
+#include <memory>
+#include <utility>
+
+#include "audio.h"
+
+// Copy-on-write handle to a clip. T is the frame type, as for audio<T>.
+// Copying a handle only bumps a reference count; the samples are cloned the
+// first time a handle that is not the sole owner is mutated. Operators that
+// build a new clip read the shared samples in place and allocate only their
+// result, so rendering many variants of one source costs one buffer each.
+template<typename T>
+class shared_audio{
+private:
+  std::shared_ptr<audio<T>> clip;
+
+public:
+  shared_audio() : clip(std::make_shared<audio<T>>()){}
+
+  shared_audio(audio<T> source) : clip(std::make_shared<audio<T>>(std::move(source))){}
+
+  const audio<T>& get() const{
+    return *clip;
+  }
+
+  const audio<T>* operator->() const{
+    return clip.get();
+  }
+
+  bool shared() const{
+    return clip.use_count() > 1;
+  }
+
+  // the clip for writing, cloned first if another handle still sees it
+  audio<T>& mutate(){
+    if(clip.use_count() > 1){
+      clip = std::make_shared<audio<T>>(*clip);
+    }
+    return *clip;
+  }
+
+  // moves the clip out, copying only if it is still shared
+  audio<T> release() &&{
+    if(clip.use_count() > 1){
+      return *clip;
+    }
+    return std::move(*clip);
+  }
+
+  const std::vector<T>& get_buffer() const{
+    return clip->get_buffer();
+  }
+
+  const T* data() const{
+    return clip->data();
+  }
+
+  std::size_t size() const{
+    return clip->size();
+  }
+
+  int get_sample_length() const{
+    return clip->get_sample_length();
+  }
+
+  const T& operator[](std::size_t index) const{
+    return (*clip)[index];
+  }
+
+  audio_view<T> view() const{
+    return clip->view();
+  }
+
+  typename audio_view<T>::rms_type calculate_rms() const{
+    return clip->view().calculate_rms();
+  }
+
+  shared_audio& operator|=(const shared_audio& rhs){
+    mutate() |= *rhs.clip;
+    return *this;
+  }
+
+  shared_audio& operator*=(const std::pair<float, float>& volume_factor){
+    mutate() *= volume_factor;
+    return *this;
+  }
+
+  shared_audio& operator+=(const shared_audio& rhs){
+    mutate() += *rhs.clip;
+    return *this;
+  }
+
+  shared_audio& operator^=(const std::pair<int, int>& range){
+    mutate() ^= range;
+    return *this;
+  }
+
+  void reverse(){
+    mutate().reverse();
+  }
+
+  shared_audio operator|(const shared_audio& rhs) const{
+    return shared_audio(*clip | *rhs.clip);
+  }
+
+  shared_audio operator*(const std::pair<float, float>& volume_factor) const{
+    return shared_audio(*clip * volume_factor);
+  }
+
+  shared_audio operator+(const shared_audio& rhs) const{
+    return shared_audio(*clip + *rhs.clip);
+  }
+
+  shared_audio operator^(const std::pair<int, int>& range) const{
+    return shared_audio(*clip ^ range);
+  }
+
+  template<typename Rms>
+  shared_audio normalize(const Rms& current_rms, float desired_rms) const{
+    return shared_audio(clip->normalize(current_rms, desired_rms));
+  }
+
+  shared_audio fade_in(float number_of_seconds, fade_curve curve = fade_curve::linear) const{
+    return shared_audio(clip->fade_in(number_of_seconds, curve));
+  }
+
+  shared_audio fade_out(float number_of_seconds, fade_curve curve = fade_curve::linear) const{
+    return shared_audio(clip->fade_out(number_of_seconds, curve));
+  }
+};
+
+#endif
@@ -0,0 +1,289 @@
+#ifndef AUDIO_STREAM_H
+#define AUDIO_STREAM_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "audio_kernels.h"
+#include "audio_pipeline.h"
+
+// Applies a chain of operations to a raw file block by block, so memory use
+// is a few blocks however long the clip is. T is the frame type, as for
+// mapped_audio. Every stage sees the clip in its own sample order: a block
+// is read from the source range that ends up at its output position and is
+// then carried through each reverse in the chain.
+template<typename T>
+class audio_stream{
+private:
+  typedef typename audio_kernels::frame_traits<T>::sample sample;
+  static const int channels = audio_kernels::frame_traits<T>::channels;
+  static const int slots = channels > 2 ? channels : 2;
+
+  enum class kind{ volume, add, fade_in, fade_out, normalize, reverse };
+
+  struct stage{
+    kind operation;
+    float gain[slots];
+    float seconds;
+    std::string path;
+    std::size_t path_frames;
+    audio_kernels::fade_curve curve;
+  };
+
+  std::string input_path;
+  int sample_length;
+  std::size_t block_frames;
+  std::size_t frames;
+  std::vector<stage> chain;
+  std::size_t depth;
+
+  // one block in flight: the source samples and the blocks its add stages need
+  struct work{
+    std::size_t source_first;
+    std::vector<T> block;
+    std::vector<std::vector<T>> addends;
+  };
+
+  static std::size_t frame_count(const std::string& path){
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if(!file){
+      throw std::runtime_error("audio_stream: cannot open " + path);
+    }
+    return (std::size_t)file.tellg() / sizeof(T);
+  }
+
+  // reads frames [first, first + count) into block, zero filling past the end of the file
+  static void read_block(std::ifstream& file, std::size_t file_frames, std::size_t first, std::size_t count, std::vector<T>& block){
+    block.assign(count, T());
+    if(first >= file_frames){
+      return;
+    }
+    std::size_t available = std::min(count, file_frames - first);
+    file.clear();
+    file.seekg(first * sizeof(T));
+    file.read(reinterpret_cast<char*>(block.data()), available * sizeof(T));
+  }
+
+  static stage make_stage(kind operation, float seconds = 0, const std::string& path = "", std::size_t path_frames = 0,
+                          audio_kernels::fade_curve curve = audio_kernels::fade_curve::linear){
+    stage op = {operation, {}, seconds, path, path_frames, curve};
+    std::fill(op.gain, op.gain + slots, 1.0f);
+    return op;
+  }
+
+  static void unpack(const std::pair<float, float>& gain, float* values){
+    values[0] = gain.first;
+    values[1] = gain.second;
+  }
+
+  template<std::size_t N>
+  static void unpack(const std::array<float, N>& gain, float* values){
+    std::copy(gain.begin(), gain.end(), values);
+  }
+
+  static void scale(sample* samples, std::size_t count, const float* gain){
+    audio_kernels::apply_channel_gains(samples, count, channels, gain);
+  }
+
+  std::size_t ramp_frames(float number_of_seconds) const{
+    return number_of_seconds > 0 ? (std::size_t)std::lround(number_of_seconds * sample_length) : 0;
+  }
+
+  // runs stages [0, last) on the block read from source frames [first, first + block.size())
+  void apply(const std::vector<stage>& stages, std::size_t last, std::size_t first, std::vector<T>& block,
+             const std::vector<std::vector<T>>& addends) const{
+    sample* samples = reinterpret_cast<sample*>(block.data());
+    std::size_t count = block.size() * channels;
+    std::size_t next_input = 0;
+    for(std::size_t s = 0; s < last; ++s){
+      const stage& op = stages[s];
+      switch(op.operation){
+        case kind::volume:
+        case kind::normalize:
+          scale(samples, count, op.gain);
+          break;
+        case kind::add:{
+          const std::vector<T>& other = addends[next_input++];
+          audio_kernels::saturating_add(samples, reinterpret_cast<const sample*>(other.data()), samples, count);
+          break;
+        }
+        case kind::fade_in:{
+          audio_kernels::envelope ramp = {0, ramp_frames(op.seconds), 0, 1, op.curve};
+          audio_kernels::apply_envelope(samples, block.size(), channels, ramp, first);
+          break;
+        }
+        case kind::fade_out:{
+          std::size_t length = ramp_frames(op.seconds), end = std::max(length, frames);
+          audio_kernels::envelope ramp = {end - length, length, 1, 0, op.curve};
+          audio_kernels::apply_envelope(samples, block.size(), channels, ramp, first + end - frames);
+          break;
+        }
+        case kind::reverse:
+          std::reverse(block.begin(), block.end());
+          first = frames - first - block.size();
+          break;
+      }
+    }
+  }
+
+  // maps a block position in the output of stages [0, last) back to the source file
+  std::size_t source_position(const std::vector<stage>& stages, std::size_t last, std::size_t first, std::size_t count) const{
+    for(std::size_t s = last; s-- > 0;){
+      if(stages[s].operation == kind::reverse){
+        first = frames - first - count;
+      }
+    }
+    return first;
+  }
+
+  // reads everything output frames [first, first + count) need, so that apply does no I/O
+  void read_work(const std::vector<stage>& stages, std::size_t last, std::size_t first, std::size_t count,
+                 std::ifstream& source, std::vector<std::ifstream>& inputs, work& item) const{
+    item.source_first = source_position(stages, last, first, count);
+    read_block(source, frames, item.source_first, count, item.block);
+    item.addends.resize(inputs.size());
+    std::size_t position = item.source_first, next_input = 0;
+    for(std::size_t s = 0; s < last; ++s){
+      if(stages[s].operation == kind::add){
+        read_block(inputs[next_input], stages[s].path_frames, position, count, item.addends[next_input]);
+        ++next_input;
+      }
+      else if(stages[s].operation == kind::reverse){
+        position = frames - position - count;
+      }
+    }
+  }
+
+  std::vector<std::ifstream> open_inputs(const std::vector<stage>& stages, std::size_t last) const{
+    std::vector<std::ifstream> inputs;
+    for(std::size_t s = 0; s < last; ++s){
+      if(stages[s].operation == kind::add){
+        inputs.push_back(std::ifstream(stages[s].path, std::ios::binary));
+        if(!inputs.back()){
+          throw std::runtime_error("audio_stream: cannot open " + stages[s].path);
+        }
+      }
+    }
+    return inputs;
+  }
+
+  // visits every block of the output of stages [0, last) in output order;
+  // reading, the stages and visit run as a pipeline on separate threads
+  template<typename Visitor>
+  pipeline_report for_each_block(const std::vector<stage>& stages, std::size_t last, Visitor visit) const{
+    std::ifstream source(input_path, std::ios::binary);
+    std::vector<std::ifstream> inputs = open_inputs(stages, last);
+    std::size_t first = 0;
+    return run_pipeline<work>(depth,
+      [&](work& item){
+        if(first >= frames){
+          return false;
+        }
+        std::size_t count = std::min(block_frames, frames - first);
+        read_work(stages, last, first, count, source, inputs, item);
+        first += count;
+        return true;
+      },
+      [&](work& item){
+        apply(stages, last, item.source_first, item.block, item.addends);
+      },
+      [&](work& item){
+        visit(item.block);
+      });
+  }
+
+  // the analysis pass behind normalize: per channel rms of the output of stages [0, last)
+  void measure(const std::vector<stage>& stages, std::size_t last, double* rms) const{
+    audio_kernels::channel_sums<typename audio_kernels::square_accumulator<sample>::type, slots> sums;
+    for_each_block(stages, last, [&](const std::vector<T>& block){
+      audio_kernels::frame_sum_of_squares<channels>(reinterpret_cast<const sample*>(block.data()), block.size(), sums.sum);
+    });
+    for(int c = 0; c < channels; ++c){
+      rms[c] = frames == 0 ? 0 : std::sqrt((double)sums.sum[c] / frames);
+    }
+  }
+
+public:
+  audio_stream(const std::string& path, int sampl_len, std::size_t block_len = 1 << 16)
+    : input_path(path), sample_length(sampl_len), block_frames(block_len), frames(frame_count(path)), depth(2){}
+
+  std::size_t size() const{
+    return frames;
+  }
+
+  typedef typename audio_kernels::frame_traits<T>::gains gain_type;
+
+  audio_stream& volume(const gain_type& volume_factor){
+    stage op = make_stage(kind::volume);
+    unpack(volume_factor, op.gain);
+    chain.push_back(op);
+    return *this;
+  }
+
+  // saturating add of a second raw file of the same frame type
+  audio_stream& add(const std::string& path){
+    chain.push_back(make_stage(kind::add, 0, path, frame_count(path)));
+    return *this;
+  }
+
+  audio_stream& fade_in(float number_of_seconds, audio_kernels::fade_curve curve = audio_kernels::fade_curve::linear){
+    chain.push_back(make_stage(kind::fade_in, number_of_seconds, "", 0, curve));
+    return *this;
+  }
+
+  audio_stream& fade_out(float number_of_seconds, audio_kernels::fade_curve curve = audio_kernels::fade_curve::linear){
+    chain.push_back(make_stage(kind::fade_out, number_of_seconds, "", 0, curve));
+    return *this;
+  }
+
+  // the gain is resolved by an analysis pass when the chain runs
+  audio_stream& normalize(float desired_rms){
+    stage op = make_stage(kind::normalize);
+    std::fill(op.gain, op.gain + slots, desired_rms);
+    chain.push_back(op);
+    return *this;
+  }
+
+  audio_stream& reverse(){
+    chain.push_back(make_stage(kind::reverse));
+    return *this;
+  }
+
+  // blocks in flight between the reader, the stages and the writer; 2 double buffers
+  audio_stream& set_depth(std::size_t blocks){
+    depth = std::max<std::size_t>(blocks, 1);
+    return *this;
+  }
+
+  // writes the output of the chain and reports how busy each pipeline stage
+  // was on that final pass
+  pipeline_report run(const std::string& output_path) const{
+    std::vector<stage> resolved = chain;
+    for(std::size_t s = 0; s < resolved.size(); ++s){
+      if(resolved[s].operation == kind::normalize){
+        double rms[slots];
+        measure(resolved, s, rms);
+        for(int c = 0; c < channels; ++c){
+          resolved[s].gain[c] = rms[c] == 0 ? 1 : (float)(chain[s].gain[c] / rms[c]);
+        }
+      }
+    }
+
+    std::ofstream output(output_path, std::ios::binary);
+    if(!output){
+      throw std::runtime_error("audio_stream: cannot create " + output_path);
+    }
+    return for_each_block(resolved, resolved.size(), [&](const std::vector<T>& block){
+      output.write(reinterpret_cast<const char*>(block.data()), block.size() * sizeof(T));
+    });
+  }
+};
+
+#endif
@@ -1,6 +1,18 @@
 #define CATCH_CONFIG_MAIN
 #include "catch.hpp"
 #include "audio.h"
+#include "audio_io.h"
+#include "audio_stream.h"
+#include "audio_expr.h"
+#include "audio_parallel.h"
+#include "audio_edit.h"
+#include "audio_shared.h"
+#include "audio_arena.h"
+#include "audio_aligned.h"
+#include "audio_mix.h"
+#include "audio_codec.h"
+#include "audio_pipeline.h"
+#include "audioops.h"
 
 TEST_CASE("constructor with size", "[Constructor]"){
   audio<int8_t> a = audio<int8_t>(0);
@@ -99,7 +111,7 @@ TEST_CASE("* operator", "[operator*]"){
   audio<int8_t> b = a * p;
   REQUIRE(b.get_buffer()[0] == 0);
   REQUIRE(b.get_buffer()[1] == 1);
-  REQUIRE(b.get_buffer()[2] == 1);
+  REQUIRE(b.get_buffer()[2] == 2);
 }
 
 TEST_CASE("+ operator", "[operator+]"){
@@ -112,6 +124,34 @@ TEST_CASE("+ operator", "[operator+]"){
   REQUIRE(c.get_buffer()[2] == 32767);
 }
 
+TEST_CASE("+ operator saturates in both directions", "[operator+]"){
+  std::vector<int8_t> v1, v2;
+  for(int i = 0; i < 19; ++i){
+    v1.push_back(i % 2 ? 100 : -100);
+    v2.push_back(i % 2 ? 100 : -100);
+  }
+  v1[18] = 1;
+  v2[18] = 2;
+  audio<int8_t> a = audio<int8_t>(v1);
+  audio<int8_t> b = audio<int8_t>(v2);
+  audio<int8_t> c = a + b;
+  REQUIRE(c.get_buffer()[0] == -128);
+  REQUIRE(c.get_buffer()[1] == 127);
+  REQUIRE(c.get_buffer()[17] == 127);
+  REQUIRE(c.get_buffer()[18] == 3);
+}
+
+TEST_CASE("+ operator saturates 32 bit samples", "[operator+]"){
+  std::vector<int32_t> v = {2000000000, -2000000000, 5, 2000000000, -7};
+  audio<int32_t> a = audio<int32_t>(v);
+  audio<int32_t> c = a + a;
+  REQUIRE(c.get_buffer()[0] == std::numeric_limits<int32_t>::max());
+  REQUIRE(c.get_buffer()[1] == std::numeric_limits<int32_t>::min());
+  REQUIRE(c.get_buffer()[2] == 10);
+  REQUIRE(c.get_buffer()[3] == std::numeric_limits<int32_t>::max());
+  REQUIRE(c.get_buffer()[4] == -14);
+}
+
 TEST_CASE("^ operator", "[operator^]"){
   audio<int> a;
   std::pair<int, int> p = {1, 2};
@@ -122,6 +162,26 @@ TEST_CASE("^ operator", "[operator^]"){
   REQUIRE(b.get_buffer()[1] == 4);
 }
 
+TEST_CASE("^ operator cuts to the end", "[operator^]"){
+  std::vector<int16_t> v = {1, 2, 3, 4, 5};
+  audio<int16_t> a = audio<int16_t>(v);
+  REQUIRE((a ^ std::make_pair(2, INT32_MAX)).get_buffer() == std::vector<int16_t>({1, 2}));
+  REQUIRE((a ^ std::make_pair(INT32_MIN, INT32_MAX)).size() == 0);
+  REQUIRE((a ^ std::make_pair(3, -5)).size() == 5);
+  audio<int16_t> c = a;
+  c ^= std::make_pair(2, INT32_MAX);
+  REQUIRE(c.size() == 2);
+  std::vector<std::pair<int8_t, int8_t>> w(5, std::make_pair(1, 2));
+  audio<std::pair<int8_t, int8_t>> s = audio<std::pair<int8_t, int8_t>>(w);
+  REQUIRE((s ^ std::make_pair(2, INT32_MAX)).size() == 2);
+  s ^= std::make_pair(1, INT32_MAX);
+  REQUIRE(s.size() == 1);
+  audio<std::array<int16_t, 3>> f(5);
+  REQUIRE((f ^ std::make_pair(2, INT32_MAX)).size() == 2);
+  f ^= std::make_pair(0, INT32_MAX);
+  REQUIRE(f.size() == 0);
+}
+
 TEST_CASE("Reverse", "[Reverse]"){
   audio<int8_t> a;
   std::vector<int8_t> v = {1, 2, 3};
@@ -172,10 +232,10 @@ TEST_CASE("Reverse", "[Reverse]"){
     audio<int8_t> a, b;
     a = audio<int8_t>(v, 2);
     b = a.fade_in(2);
-    REQUIRE(b.get_buffer()[0] == 2);
-    REQUIRE(b.get_buffer()[1] == 10);
-    REQUIRE(b.get_buffer()[2] == 23);
-    REQUIRE(b.get_buffer()[3] == 40);
+    REQUIRE(b.get_buffer()[0] == 0);
+    REQUIRE(b.get_buffer()[1] == 5);
+    REQUIRE(b.get_buffer()[2] == 15);
+    REQUIRE(b.get_buffer()[3] == 30);
     REQUIRE(b.get_buffer()[4] == 50);
   }
 
@@ -183,12 +243,40 @@ TEST_CASE("Reverse", "[Reverse]"){
     std::vector<int8_t> v = {10, 20, 30, 40, 50};
     audio<int8_t> a, b;
     a = audio<int8_t>(v, 2);
-    b = a.fade_in(2);
-    REQUIRE(b.get_buffer()[0] == 8);
-    REQUIRE(b.get_buffer()[1] == 10);
-    REQUIRE(b.get_buffer()[2] == 8);
-    REQUIRE(b.get_buffer()[3] == 0);
-    REQUIRE(b.get_buffer()[4] == 50);
+    b = a.fade_out(2);
+    REQUIRE(b.get_buffer()[0] == 10);
+    REQUIRE(b.get_buffer()[1] == 15);
+    REQUIRE(b.get_buffer()[2] == 15);
+    REQUIRE(b.get_buffer()[3] == 10);
+    REQUIRE(b.get_buffer()[4] == 0);
+  }
+
+  TEST_CASE("Compound assignment operators", "[In place]"){
+    std::vector<int8_t> v = {10, 20, 30, 40};
+    audio<int8_t> a = audio<int8_t>(v);
+    audio<int8_t> b = a;
+    b *= std::make_pair(0.5f, 0.5f);
+    b += a;
+    REQUIRE(b.get_buffer()[0] == 15);
+    REQUIRE(b.get_buffer()[3] == 60);
+    b ^= std::make_pair(1, 2);
+    REQUIRE(b.get_buffer().size() == 2);
+    REQUIRE(b.get_buffer()[1] == 60);
+    b |= b;
+    REQUIRE(b.get_buffer().size() == 4);
+    REQUIRE(b.get_buffer()[2] == 15);
+    REQUIRE(b.get_buffer()[3] == 60);
+  }
+
+  TEST_CASE("Operator chains reuse temporary buffers", "[In place]"){
+    std::vector<int16_t> v = {100, 200, 300, 400};
+    audio<int16_t> a = audio<int16_t>(v, 2);
+    audio<int16_t> b = a * std::make_pair(0.5f, 0.5f);
+    int16_t* buffer = &b[0];
+    audio<int16_t> c = (((std::move(b) + a) * std::make_pair(2.0f, 2.0f)).normalize(1, 1) ^ std::make_pair(5, 6)).fade_in(1);
+    REQUIRE(&c[0] == buffer);
+    REQUIRE(c.get_buffer()[1] == 600 / 2);
+    REQUIRE(c.get_buffer()[3] == 1200);
   }
 
   TEST_CASE("DEFAULT CONSTRUCTOR", "[CONSTRUCTOR]"){
@@ -274,6 +362,16 @@ TEST_CASE("Reverse", "[Reverse]"){
     REQUIRE(c.get_buffer()[0].second == 2);
     REQUIRE(c.get_buffer()[1].first == 1);
     REQUIRE(c.get_buffer()[1].second == 2);
+    c |= c;
+    REQUIRE(c.size() == 4);
+    REQUIRE(c.get_buffer()[3] == p1);
+    c = std::move(c) | c;
+    REQUIRE(c.size() == 8);
+    REQUIRE(c.get_buffer()[7] == p1);
+    std::array<int16_t, 3> f1 = {{1, 2, 3}}, f2 = {{4, 5, 6}};
+    audio<std::array<int16_t, 3>> f(std::vector<std::array<int16_t, 3>>({f1, f2}));
+    f |= f;
+    REQUIRE((f.get_buffer() == std::vector<std::array<int16_t, 3>>({f1, f2, f1, f2})));
   }
 
   TEST_CASE("Stereo *operator", "[operator*]"){
@@ -307,6 +405,18 @@ TEST_CASE("Reverse", "[Reverse]"){
     REQUIRE(c.get_buffer()[0].second == 6);
   }
 
+  TEST_CASE("Stereo +operator saturates", "[operator+]"){
+    std::pair<int16_t, int16_t> p1 = {30000, -30000};
+    std::vector<std::pair<int16_t, int16_t>> v = {p1, p1, p1, p1, p1};
+    audio<std::pair<int16_t, int16_t>> a, c;
+    a = audio<std::pair<int16_t, int16_t>>(v);
+    c = a + a;
+    REQUIRE(c.get_buffer()[0].first == 32767);
+    REQUIRE(c.get_buffer()[0].second == -32768);
+    REQUIRE(c.get_buffer()[4].first == 32767);
+    REQUIRE(c.get_buffer()[4].second == -32768);
+  }
+
   TEST_CASE("Stereo ^ operator", "[operator^]"){
     audio<std::pair<int8_t, int8_t>> a, b;
     std::pair<int, int> p = {1, 2};
@@ -358,3 +468,995 @@ TEST_CASE("Reverse", "[Reverse]"){
     std::pair<float, float> rms_pair = a.calculate_rms();
     b = a.normalize(rms_pair, 2);
   }
+
+  TEST_CASE("Planar stereo round trip", "[Planar]"){
+    std::pair<int8_t, int8_t> p1, p2;
+    p1 = {1, 2};
+    p2 = {3, 4};
+    std::vector<std::pair<int8_t, int8_t>> v = {p1, p2};
+    audio<std::pair<int8_t, int8_t>> a = audio<std::pair<int8_t, int8_t>>(v, 2);
+    planar_audio<int8_t> p(a);
+    REQUIRE(p.left_channel().get_buffer()[1] == 3);
+    REQUIRE(p.right_channel().get_buffer()[1] == 4);
+    audio<std::pair<int8_t, int8_t>> b = p.interleave();
+    REQUIRE(b.get_sample_length() == 2);
+    REQUIRE(b.get_buffer()[0].first == 1);
+    REQUIRE(b.get_buffer()[0].second == 2);
+    REQUIRE(b.get_buffer()[1].first == 3);
+    REQUIRE(b.get_buffer()[1].second == 4);
+    REQUIRE(audio_memory::is_aligned(p.left_channel().data()));
+    REQUIRE(audio_memory::is_aligned(p.right_channel().data()));
+    audio<int16_t> left = audio<int16_t>(std::vector<int16_t>(1001, 5), 10), right = audio<int16_t>(std::vector<int16_t>(1001, -5), 10);
+    planar_audio<int16_t> q(left, right, 10);
+    REQUIRE(audio_memory::is_aligned((q * std::make_pair(2.0f, 2.0f)).right_channel().data()));
+    REQUIRE((q + q).left_channel()[1000] == 10);
+    REQUIRE(audio_memory::is_aligned((q ^ std::make_pair(1, 999)).right_channel().data()));
+    planar_audio<int16_t, std::allocator<int16_t>> r(left, right, 10);
+    REQUIRE(r.interleave().get_buffer()[1000].second == -5);
+  }
+
+  TEST_CASE("Planar stereo operators", "[Planar]"){
+    std::pair<int8_t, int8_t> p1, p2;
+    p1 = {10, 20};
+    p2 = {30, 40};
+    std::vector<std::pair<int8_t, int8_t>> v = {p1, p2};
+    planar_audio<int8_t> a = planar_audio<int8_t>(audio<std::pair<int8_t, int8_t>>(v));
+    audio<std::pair<int8_t, int8_t>> c = (a * std::make_pair(0.5f, 0.3f)).interleave();
+    REQUIRE(c.get_buffer()[0].first == 5);
+    REQUIRE(c.get_buffer()[0].second == 6);
+    REQUIRE(c.get_buffer()[1].first == 15);
+    REQUIRE(c.get_buffer()[1].second == 12);
+    audio<std::pair<int8_t, int8_t>> d = (a + a).interleave();
+    REQUIRE(d.get_buffer()[1].first == 60);
+    REQUIRE(d.get_buffer()[1].second == 80);
+    std::pair<float, float> rms_pair = a.calculate_rms();
+    REQUIRE(rms_pair.first == (float)sqrt(1000.0 / 2));
+  }
+
+  TEST_CASE("Mapped raw clip", "[Mapped]"){
+    {
+      mapped_audio<int16_t> out = mapped_audio<int16_t>::create("mapped_audio_test.raw", 3, 44100);
+      out[0] = 1;
+      out[1] = -2;
+      out[2] = 300;
+      out.sync();
+    }
+    SECTION("Read only mapping"){
+      mapped_audio<int16_t> a("mapped_audio_test.raw", 44100);
+      REQUIRE(a.size() == 3);
+      REQUIRE(a[1] == -2);
+      audio<int16_t> b = a.to_audio();
+      REQUIRE(b.get_buffer()[2] == 300);
+      REQUIRE(b.get_sample_length() == 44100);
+      REQUIRE(a.view().calculate_rms() == (float)sqrt((1 + 4 + 90000) / 3.0));
+    }
+    SECTION("Copy on write mapping leaves the file untouched"){
+      {
+        mapped_audio<int16_t> a("mapped_audio_test.raw", 44100, map_mode::copy_on_write);
+        a[0] = 99;
+        REQUIRE(a[0] == 99);
+      }
+      mapped_audio<int16_t> a("mapped_audio_test.raw", 44100);
+      REQUIRE(a[0] == 1);
+    }
+    SECTION("Stereo frames"){
+      mapped_audio<std::pair<int16_t, int16_t>> a("mapped_audio_test.raw", 44100);
+      REQUIRE(a.size() == 1);
+      REQUIRE(a[0].first == 1);
+      REQUIRE(a[0].second == -2);
+    }
+    std::remove("mapped_audio_test.raw");
+  }
+
+  template<typename T>
+  void write_raw_file(const std::string& path, const std::vector<T>& samples){
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(samples.data()), samples.size() * sizeof(T));
+  }
+
+  template<typename T>
+  std::vector<T> read_raw_file(const std::string& path){
+    mapped_audio<T> clip(path, 0);
+    return std::vector<T>(clip.begin(), clip.end());
+  }
+
+  TEST_CASE("Streaming chain", "[Stream]"){
+    write_raw_file<int8_t>("stream_a.raw", {10, 20, 30, 40, 50});
+    write_raw_file<int8_t>("stream_b.raw", {1, 2, 3, 4, 120});
+    SECTION("Volume and add"){
+      audio_stream<int8_t>("stream_a.raw", 2, 2).volume({0.5, 0.5}).add("stream_b.raw").run("stream_out.raw");
+      std::vector<int8_t> out = read_raw_file<int8_t>("stream_out.raw");
+      REQUIRE(out.size() == 5);
+      REQUIRE(out[0] == 6);
+      REQUIRE(out[3] == 24);
+      REQUIRE(out[4] == 127);
+    }
+    SECTION("Reverse across uneven blocks"){
+      audio_stream<int8_t>("stream_a.raw", 2, 2).reverse().add("stream_b.raw").run("stream_out.raw");
+      std::vector<int8_t> out = read_raw_file<int8_t>("stream_out.raw");
+      REQUIRE(out[0] == 51);
+      REQUIRE(out[1] == 42);
+      REQUIRE(out[2] == 33);
+      REQUIRE(out[3] == 24);
+      REQUIRE(out[4] == 127);
+    }
+    SECTION("Normalize after analysis pass"){
+      audio_stream<int8_t>("stream_a.raw", 2, 2).normalize(sqrt(5500.0 / 5) / 2).run("stream_out.raw");
+      std::vector<int8_t> out = read_raw_file<int8_t>("stream_out.raw");
+      REQUIRE(out[0] == 5);
+      REQUIRE(out[4] == 25);
+    }
+    SECTION("Fades"){
+      audio_stream<int8_t>("stream_a.raw", 2, 2).fade_in(1).fade_out(1).run("stream_out.raw");
+      std::vector<int8_t> out = read_raw_file<int8_t>("stream_out.raw");
+      REQUIRE(out[0] == 0);
+      REQUIRE(out[1] == 10);
+      REQUIRE(out[2] == 30);
+      REQUIRE(out[3] == 20);
+      REQUIRE(out[4] == 0);
+    }
+    SECTION("Stereo frames"){
+      write_raw_file<int8_t>("stream_s.raw", {10, 20, 30, 40});
+      audio_stream<std::pair<int8_t, int8_t>>("stream_s.raw", 2).volume({0.5, 0.3}).reverse().run("stream_out.raw");
+      std::vector<std::pair<int8_t, int8_t>> out = read_raw_file<std::pair<int8_t, int8_t>>("stream_out.raw");
+      REQUIRE(out[0].first == 15);
+      REQUIRE(out[0].second == 12);
+      REQUIRE(out[1].first == 5);
+      REQUIRE(out[1].second == 6);
+      std::remove("stream_s.raw");
+    }
+    SECTION("Surround frames"){
+      typedef std::array<int16_t, 6> frame;
+      write_raw_file<int16_t>("stream_s.raw", {100, 200, 300, 400, 500, 600, -100, -200, -300, -400, -500, -600});
+      std::array<float, 6> gains = {{1, 1, 1, 1, 1, 0}};
+      audio_stream<frame>("stream_s.raw", 2).volume(gains).normalize(50).run("stream_out.raw");
+      std::vector<frame> out = read_raw_file<frame>("stream_out.raw");
+      REQUIRE(out.size() == 2);
+      REQUIRE(out[0][0] == 50);
+      REQUIRE(out[1][4] == -50);
+      REQUIRE(out[0][5] == 0);
+      std::remove("stream_s.raw");
+    }
+    std::remove("stream_a.raw");
+    std::remove("stream_b.raw");
+    std::remove("stream_out.raw");
+  }
+
+  TEST_CASE("Lazy expressions saturate only on store", "[Expression]"){
+    std::vector<int8_t> v1 = {100, 10, -100};
+    std::vector<int8_t> v2 = {100, 20, 100};
+    audio<int8_t> a = audio<int8_t>(v1, 2);
+    audio<int8_t> b = audio<int8_t>(v2, 2);
+    using audio_expr::lazy;
+    audio<int8_t> c = lazy(a) + lazy(a) + lazy(b) * std::make_pair(-1.0f, -1.0f);
+    REQUIRE(c.get_sample_length() == 2);
+    REQUIRE(c.get_buffer()[0] == 100);
+    REQUIRE(c.get_buffer()[1] == 0);
+    REQUIRE(c.get_buffer()[2] == -128);
+    c = lazy(a) * std::make_pair(0.5f, 0.5f) + lazy(b) * std::make_pair(0.25f, 0.25f);
+    REQUIRE(c.get_buffer()[0] == 75);
+    REQUIRE(c.get_buffer()[1] == 10);
+    REQUIRE(c.get_buffer()[2] == -25);
+    audio<int8_t> odd = audio<int8_t>(std::vector<int8_t>({3, 5, -7}), 2);
+    c = lazy(odd) * std::make_pair(0.5f, 0.5f);
+    REQUIRE(c.get_buffer() == std::vector<int8_t>({2, 2, -4}));
+    c = lazy(a) * std::make_pair(NAN, NAN) + lazy(b) * std::make_pair(1e30f, 1e30f);
+    REQUIRE(c.get_buffer() == std::vector<int8_t>({0, 0, 0}));
+    c = lazy(b) * std::make_pair(1e30f, 1e30f);
+    REQUIRE(c.get_buffer() == std::vector<int8_t>({127, 127, 127}));
+  }
+
+  TEST_CASE("Stereo lazy expressions", "[Expression]"){
+    std::pair<int8_t, int8_t> p1 = {10, 20};
+    std::vector<std::pair<int8_t, int8_t>> v = {p1, p1};
+    audio<std::pair<int8_t, int8_t>> a = audio<std::pair<int8_t, int8_t>>(v);
+    using audio_expr::lazy;
+    audio<std::pair<int8_t, int8_t>> c = lazy(a) * std::make_pair(0.5f, 0.3f) + lazy(a);
+    REQUIRE(c.get_buffer()[1].first == 15);
+    REQUIRE(c.get_buffer()[1].second == 26);
+  }
+
+  TEST_CASE("Multichannel lazy expressions", "[Expression]"){
+    std::array<int8_t, 3> f = {{10, 20, 100}};
+    audio<std::array<int8_t, 3>> a = audio<std::array<int8_t, 3>>(std::vector<std::array<int8_t, 3>>(2, f), 4);
+    using audio_expr::lazy;
+    std::array<float, 3> gains = {{0.5f, 0.3f, 1.0f}};
+    audio<std::array<int8_t, 3>> c = lazy(a) * gains + lazy(a);
+    REQUIRE(c.size() == 2);
+    REQUIRE(c.get_sample_length() == 4);
+    REQUIRE(c[1][0] == 15);
+    REQUIRE(c[1][1] == 26);
+    REQUIRE(c[1][2] == 127);
+    c = lazy(a) + lazy(a) * std::array<float, 3>{{-1.0f, -1.0f, -2.0f}};
+    REQUIRE(c[0][0] == 0);
+    REQUIRE(c[0][2] == -100);
+  }
+
+  TEST_CASE("Parallel operators match the serial path", "[Parallel]"){
+    std::vector<int16_t> v(300000);
+    for(std::size_t i = 0; i < v.size(); ++i){
+      v[i] = (int16_t)(i * 7919);
+    }
+    audio<int16_t> a = audio<int16_t>(v, 44100);
+    audio_parallel::set_threads(1);
+    audio<int16_t> serial = (a + a) * std::make_pair(0.7f, 0.7f);
+    float serial_rms = serial.calculate_rms();
+    audio_parallel::set_threads(4);
+    audio_parallel::set_threshold(1024);
+    audio<int16_t> parallel = (a + a) * std::make_pair(0.7f, 0.7f);
+    float parallel_rms = parallel.calculate_rms();
+    audio_parallel::set_threads(std::thread::hardware_concurrency());
+    audio_parallel::set_threshold(1 << 18);
+    REQUIRE(serial.get_buffer() == parallel.get_buffer());
+    REQUIRE(serial_rms == parallel_rms);
+  }
+
+  TEST_CASE("Nested parallel work", "[Parallel]"){
+    audio_parallel::set_threads(4);
+    audio_parallel::set_threshold(1024);
+    std::vector<std::size_t> sums(64, 0);
+    std::shared_ptr<audio_parallel::thread_pool> running = audio_parallel::pool();
+    audio_parallel::for_each_task(sums.size(), [&](std::size_t t){
+      std::atomic<std::size_t> total(0);
+      audio_parallel::for_each_chunk<int16_t>(1 << 16, [&](std::size_t begin, std::size_t end){
+        total += end - begin;
+      });
+      sums[t] = total;
+    });
+    REQUIRE(std::count(sums.begin(), sums.end(), (std::size_t)1 << 16) == 64);
+    audio_parallel::set_threads(2);
+    REQUIRE(audio_parallel::pool()->size() == 2);
+    std::atomic<std::size_t> ran(0);
+    running->run(16, [&](std::size_t){ ++ran; });
+    REQUIRE(ran == 16);
+    audio_parallel::set_threads(std::thread::hardware_concurrency());
+    audio_parallel::set_threshold(1 << 18);
+  }
+
+  TEST_CASE("Exceptions from parallel tasks", "[Parallel]"){
+    audio_parallel::thread_pool pool(4);
+    std::atomic<std::size_t> ran(0);
+    auto fail_at = [&](std::size_t bad){
+      return [&, bad](std::size_t t){
+        if(t == bad){
+          throw std::runtime_error("task " + std::to_string(t));
+        }
+        ++ran;
+      };
+    };
+    auto message = [&](std::size_t bad){
+      try{
+        pool.run(1000, fail_at(bad));
+      }
+      catch(const std::runtime_error& error){
+        return std::string(error.what());
+      }
+      return std::string();
+    };
+    REQUIRE(message(0) == "task 0");
+    REQUIRE(message(999) == "task 999");
+    REQUIRE(ran < 2000);
+    ran = 0;
+    pool.run(1000, [&](std::size_t){ ++ran; });
+    REQUIRE(ran == 1000);
+    audio_parallel::set_threads(4);
+    REQUIRE_THROWS(audio_parallel::for_each_task(64, fail_at(7)));
+    audio_parallel::set_threads(std::thread::hardware_concurrency());
+  }
+
+  TEST_CASE("RMS does not overflow narrow samples", "[Calculate RMS]"){
+    std::vector<int8_t> v(1000, -128);
+    v[999] = 0;
+    audio<int8_t> a = audio<int8_t>(v);
+    REQUIRE(a.calculate_rms() == (float)sqrt(999.0 * 16384 / 1000));
+    REQUIRE(a.calculate_rms(std::make_pair(10, 19)) == 128);
+    std::vector<int16_t> w(37, -32768);
+    audio<int16_t> b = audio<int16_t>(w);
+    REQUIRE(b.calculate_rms() == 32768);
+    std::vector<int32_t> x = {3, -4, 3, -4, 3};
+    audio<int32_t> c = audio<int32_t>(x);
+    REQUIRE(c.calculate_rms(std::make_pair(0, 3)) == (float)sqrt(12.5));
+  }
+
+  TEST_CASE("Stereo RMS per channel over a range", "[Calculate RMS]"){
+    std::vector<std::pair<int16_t, int16_t>> v;
+    for(int i = 0; i < 21; ++i){
+      v.push_back(std::make_pair((int16_t)-32768, (int16_t)(i % 2 ? 3 : -3)));
+    }
+    audio<std::pair<int16_t, int16_t>> a = audio<std::pair<int16_t, int16_t>>(v);
+    std::pair<float, float> rms_pair = a.calculate_rms();
+    REQUIRE(rms_pair.first == 32768);
+    REQUIRE(rms_pair.second == 3);
+    rms_pair = a.calculate_rms(std::make_pair(5, 5));
+    REQUIRE(rms_pair.second == 3);
+    std::vector<std::pair<int8_t, int8_t>> w(40, std::make_pair((int8_t)-128, (int8_t)5));
+    audio<std::pair<int8_t, int8_t>> b = audio<std::pair<int8_t, int8_t>>(w);
+    REQUIRE(b.calculate_rms().first == 128);
+    REQUIRE(b.calculate_rms().second == 5);
+  }
+
+  TEST_CASE("Fade curves", "[Envelope]"){
+    std::vector<int16_t> v(1000, 10000);
+    audio<int16_t> a = audio<int16_t>(v, 1000);
+    SECTION("Equal power fade in over part of a second"){
+      audio<int16_t> b = a.fade_in(0.1f, fade_curve::equal_power);
+      for(int k = 0; k < 100; k += 7){
+        REQUIRE(std::abs(b[k] - (int)(10000 * sin(k / 100.0 * M_PI / 2))) <= 1);
+      }
+      REQUIRE(b[100] == 10000);
+    }
+    SECTION("Exponential fade out ends silent"){
+      audio<int16_t> b = a.fade_out(0.5f, fade_curve::exponential);
+      REQUIRE(b[499] == 10000);
+      REQUIRE(b[999] == 0);
+      REQUIRE(b[750] < 10000 * 0.5 * 0.5);
+      for(int k = 500; k < 999; ++k){
+        REQUIRE(b[k] >= b[k + 1]);
+      }
+    }
+    SECTION("Envelope at an arbitrary position"){
+      audio_kernels::envelope ramp = {300, 200, 1, 0.5f, fade_curve::linear};
+      a.apply_envelope(ramp);
+      REQUIRE(a[299] == 10000);
+      REQUIRE(a[300] == 9975);
+      REQUIRE(a[499] == 5000);
+      REQUIRE(a[500] == 10000);
+    }
+  }
+
+  TEST_CASE("Fade longer than the clip", "[Envelope]"){
+    std::vector<int8_t> v = {100, 100};
+    audio<int8_t> a = audio<int8_t>(v, 4);
+    audio<int8_t> b = a.fade_in(1);
+    REQUIRE(b.get_buffer()[0] == 0);
+    REQUIRE(b.get_buffer()[1] == 25);
+    b = a.fade_out(1);
+    REQUIRE(b.get_buffer()[0] == 25);
+    REQUIRE(b.get_buffer()[1] == 0);
+  }
+
+  TEST_CASE("Stereo fades share the envelope kernel", "[Envelope]"){
+    std::vector<std::pair<int8_t, int8_t>> v(20, std::make_pair((int8_t)100, (int8_t)-100));
+    audio<std::pair<int8_t, int8_t>> a = audio<std::pair<int8_t, int8_t>>(v, 10);
+    audio<std::pair<int8_t, int8_t>> b = a.fade_in(1).fade_out(1);
+    REQUIRE(b.get_buffer()[0].first == 0);
+    REQUIRE(b.get_buffer()[5].first == 50);
+    REQUIRE(b.get_buffer()[5].second == -50);
+    REQUIRE(b.get_buffer()[10].first == 90);
+    REQUIRE(b.get_buffer()[19].second == 0);
+  }
+
+  TEST_CASE("Piece table edits", "[Edit]"){
+    std::vector<int> v = {1, 2, 3, 4, 5, 6};
+    audio<int> a = audio<int>(v, 2);
+    audio_edit<int> e(a);
+    audio_edit<int> f = (e | e) ^ std::make_pair(2, 7);
+    REQUIRE(f.size() == 6);
+    REQUIRE(f.get_sample_length() == 2);
+    REQUIRE(f.to_audio().get_buffer() == ((a | a) ^ std::make_pair(2, 7)).get_buffer());
+    REQUIRE(f[2] == 3);
+    REQUIRE(f[5] == 6);
+    audio_edit<int> g = f.slice(std::make_pair(1, 3));
+    REQUIRE(g.to_audio().get_buffer() == std::vector<int>({2, 3, 4}));
+    f.insert(1, g);
+    REQUIRE(f.to_audio().get_buffer() == std::vector<int>({1, 2, 3, 4, 2, 3, 4, 5, 6}));
+    REQUIRE(f.slice(std::make_pair(7, INT32_MAX)).to_audio().get_buffer() == std::vector<int>({5, 6}));
+    f ^= std::make_pair(3, INT32_MAX);
+    REQUIRE(f.to_audio().get_buffer() == std::vector<int>({1, 2, 3}));
+    f ^= std::make_pair(0, 100);
+    REQUIRE(f.size() == 0);
+  }
+
+  TEST_CASE("Stereo piece table", "[Edit]"){
+    std::vector<std::pair<int8_t, int8_t>> v = {{1, 2}, {3, 4}, {5, 6}};
+    audio_edit<std::pair<int8_t, int8_t>> e(audio<std::pair<int8_t, int8_t>>(v, 1));
+    audio<std::pair<int8_t, int8_t>> b = (e ^ std::make_pair(1, 1)).to_audio();
+    REQUIRE(b.get_buffer()[1].first == 5);
+    REQUIRE(b.get_buffer()[1].second == 6);
+  }
+
+  TEST_CASE("Views over clip ranges", "[View]"){
+    std::vector<int8_t> v = {1, 2, 3, 4, 5, 6};
+    audio<int8_t> a = audio<int8_t>(v, 3);
+    audio_view<int8_t> first = a.view(std::make_pair(0, 2));
+    audio_view<int8_t> last = a.view(std::make_pair(3, 5));
+    REQUIRE(first.size() == 3);
+    REQUIRE(last[0] == 4);
+    REQUIRE(&last[0] == &a[3]);
+    audio<int8_t> sum = first + last;
+    REQUIRE(sum.get_buffer() == std::vector<int8_t>({5, 7, 9}));
+    REQUIRE(sum.get_sample_length() == 3);
+    REQUIRE((last * std::make_pair(0.5f, 0.5f)).get_buffer() == std::vector<int8_t>({2, 2, 3}));
+    REQUIRE(first.calculate_rms() == (float)sqrt(14.0 / 3));
+    REQUIRE(last.fade_in(1).get_buffer() == std::vector<int8_t>({0, 2, 4}));
+    REQUIRE(a.view(std::make_pair(4, 100)).size() == 2);
+    REQUIRE(a.view(std::make_pair(2, INT32_MAX)).to_audio().get_buffer() == std::vector<int8_t>({3, 4, 5, 6}));
+    REQUIRE(a.ranged_add(std::make_pair(4, INT32_MAX), std::make_pair(0, INT32_MAX), a).size() == 2);
+    REQUIRE(a.calculate_rms(std::make_pair(5, INT32_MAX)) == 6);
+  }
+
+  TEST_CASE("Stereo views", "[View]"){
+    std::vector<std::pair<int8_t, int8_t>> v = {{1, 2}, {3, 4}, {5, 6}};
+    audio<std::pair<int8_t, int8_t>> a = audio<std::pair<int8_t, int8_t>>(v);
+    audio<std::pair<int8_t, int8_t>> b = a.view(std::make_pair(1, 2)) * std::make_pair(1.0f, 0.5f);
+    REQUIRE(b.get_buffer()[1].first == 5);
+    REQUIRE(b.get_buffer()[1].second == 3);
+    std::pair<float, float> rms_pair = a.view(std::make_pair(1, 1)).calculate_rms();
+    REQUIRE(rms_pair.first == 3);
+    REQUIRE(rms_pair.second == 4);
+  }
+
+  TEST_CASE("Buffer access without copies", "[Access]"){
+    std::vector<int16_t> v = {1, 2, 3};
+    const audio<int16_t> a = audio<int16_t>(v);
+    REQUIRE(&a.get_buffer() == &a.get_buffer());
+    REQUIRE(a.data() == &a[0]);
+    REQUIRE(a.size() == 3);
+    int sum = 0;
+    for(int16_t sample : a){
+      sum += sample;
+    }
+    REQUIRE(sum == 6);
+    std::vector<std::pair<int8_t, int8_t>> w = {{1, 2}, {3, 4}};
+    const audio<std::pair<int8_t, int8_t>> b = audio<std::pair<int8_t, int8_t>>(w);
+    REQUIRE(b.data() == &b[0]);
+    REQUIRE(b[1].second == 4);
+    int right = 0;
+    for(const std::pair<int8_t, int8_t>& frame : b){
+      right += frame.second;
+    }
+    REQUIRE(right == 6);
+  }
+
+  TEST_CASE("Copy-on-write clips", "[Shared]"){
+    std::vector<int16_t> v = {100, 200, 300};
+    shared_audio<int16_t> source = audio<int16_t>(v, 10);
+    shared_audio<int16_t> copy = source;
+    REQUIRE(copy.shared());
+    REQUIRE(copy.data() == source.data());
+    shared_audio<int16_t> quiet = source * std::make_pair(0.5f, 0.5f);
+    REQUIRE(!quiet.shared());
+    REQUIRE(quiet[2] == 150);
+    copy *= std::make_pair(2.0f, 2.0f);
+    REQUIRE(!copy.shared());
+    REQUIRE(copy.data() != source.data());
+    REQUIRE(copy[0] == 200);
+    REQUIRE(source[0] == 100);
+    REQUIRE(copy.get_sample_length() == 10);
+    const int16_t* unique = quiet.data();
+    quiet.reverse();
+    REQUIRE(quiet.data() == unique);
+    audio<int16_t> released = std::move(quiet).release();
+    REQUIRE(released.data() == unique);
+    REQUIRE(released[0] == 150);
+  }
+
+  TEST_CASE("Arena allocated clips", "[Arena]"){
+    typedef audio<int16_t, arena_allocator<int16_t>> arena_clip;
+    typedef audio<std::pair<int16_t, int16_t>, arena_allocator<std::pair<int16_t, int16_t>>> arena_stereo;
+    audio_arena arena(1 << 12);
+    {
+      audio_arena::scope job(arena);
+      arena_clip a = arena_clip(arena_clip::buffer_type({100, 200, 300}), 10);
+      arena_clip b = a * std::make_pair(0.5f, 0.5f) + a;
+      REQUIRE(b[2] == 450);
+      REQUIRE(b.get_sample_length() == 10);
+      arena_clip c = a.ranged_add(std::make_pair(1, 2), std::make_pair(0, 1), a);
+      REQUIRE(c.size() == 2);
+      REQUIRE(c[0] == 300);
+      REQUIRE((a | c).size() == 5);
+      arena_stereo s = arena_stereo(arena_stereo::buffer_type({{1, 2}, {3, 4}}), 10);
+      s = s.fade_in(0.1f) + s;
+      REQUIRE(s[1].second == 8);
+      REQUIRE(arena.capacity() == 1 << 12);
+    }
+    arena.reset();
+    std::size_t capacity = arena.capacity();
+    for(int job = 0; job < 100; ++job){
+      arena.reset();
+      audio_arena::scope scope(arena);
+      arena_clip a = arena_clip(arena_clip::buffer_type(256, 7), 10);
+      REQUIRE((a + a * std::make_pair(2.0f, 2.0f))[255] == 21);
+    }
+    REQUIRE(arena.capacity() == capacity);
+  }
+
+  TEST_CASE("Cache line aligned clips", "[Aligned]"){
+    aligned_audio<int16_t> a = aligned_audio<int16_t>(aligned_audio<int16_t>::buffer_type(1000, 3), 10);
+    REQUIRE(audio_memory::is_aligned(a.data()));
+    REQUIRE(audio_memory::is_aligned((a * std::make_pair(2.0f, 2.0f)).data()));
+    REQUIRE((a + a)[999] == 6);
+    aligned_audio<std::pair<int8_t, int8_t>> b(7);
+    REQUIRE(audio_memory::is_aligned((b | b).data()));
+    std::size_t chunk = audio_parallel::chunk_samples<std::pair<int16_t, int16_t>>() * sizeof(std::pair<int16_t, int16_t>);
+    std::size_t odd_chunk = audio_parallel::chunk_samples<char[3]>() * 3;
+    REQUIRE(0 == chunk % audio_memory::cache_line);
+    REQUIRE(0 == odd_chunk % audio_memory::cache_line);
+    audio_arena arena(1000);
+    arena.allocate(3);
+    REQUIRE(audio_memory::is_aligned(arena.allocate(5)));
+  }
+
+  TEST_CASE("Every instruction set level gives the same result", "[Dispatch]"){
+    using audio_kernels::isa;
+    std::vector<int8_t> a8(301), b8(301);
+    std::vector<int16_t> a16(301), b16(301);
+    std::vector<int32_t> a32(301), b32(301);
+    std::vector<float> gains(301);
+    for(std::size_t i = 0; i < 301; ++i){
+      unsigned x = (unsigned)(i * 2654435761u), y = (unsigned)((i + 7) * 40503u * 2654435761u);
+      a8[i] = (int8_t)(x >> 24);
+      b8[i] = (int8_t)(y >> 24);
+      a16[i] = (int16_t)(x >> 16);
+      b16[i] = (int16_t)(y >> 16);
+      a32[i] = (int32_t)x;
+      b32[i] = (int32_t)y;
+      gains[i] = (float)i / 300;
+    }
+    // products past 2^31 must clamp, not wrap through the float conversion
+    a8[5] = 100;
+    a16[5] = 1000;
+    a16[6] = -1000;
+    gains[5] = 3e7f;
+    gains[6] = 3e6f;
+    // products that are not finite are silenced, on the vector lanes and the tail
+    for(std::size_t i : {7, 8, 9, 300}){
+      a8[i] = 100;
+      a16[i] = -1000;
+    }
+    gains[7] = NAN;
+    gains[8] = INFINITY;
+    gains[9] = -INFINITY;
+    gains[300] = NAN;
+    float channel_gains[3] = {0.5f, 2.0f, 3e7f};
+    isa original = audio_kernels::active_isa();
+    audio_kernels::set_isa(isa::scalar);
+    std::vector<int8_t> sum8(301), scaled8 = a8;
+    std::vector<int16_t> sum16(301), scaled16 = a16;
+    std::vector<int32_t> sum32(301);
+    int64_t squares8[2] = {0, 0}, squares16[2] = {0, 0};
+    audio_kernels::saturating_add(a8.data(), b8.data(), sum8.data(), 301);
+    audio_kernels::saturating_add(a16.data(), b16.data(), sum16.data(), 301);
+    audio_kernels::saturating_add(a32.data(), b32.data(), sum32.data(), 301);
+    audio_kernels::sum_of_squares(a8.data(), 300, 2, squares8);
+    audio_kernels::sum_of_squares(a16.data(), 300, 2, squares16);
+    audio_kernels::apply_gains(scaled8.data(), gains.data(), 301);
+    audio_kernels::apply_gains(scaled16.data(), gains.data(), 301);
+    std::vector<int16_t> channels16 = a16;
+    audio_kernels::apply_channel_gains(channels16.data(), 301, 3, channel_gains, 1);
+    REQUIRE(scaled8[5] == 127);
+    REQUIRE(scaled16[5] == 32767);
+    REQUIRE(scaled16[6] == -32768);
+    for(std::size_t i : {7, 8, 9, 300}){
+      REQUIRE(scaled8[i] == 0);
+      REQUIRE(scaled16[i] == 0);
+    }
+    for(int level = (int)isa::sse2; level <= (int)audio_kernels::supported_isa(); ++level){
+      audio_kernels::set_isa((isa)level);
+      INFO(audio_kernels::isa_name((isa)level));
+      std::vector<int8_t> out8(301), gained8 = a8;
+      std::vector<int16_t> out16(301), gained16 = a16;
+      std::vector<int32_t> out32(301);
+      int64_t level8[2] = {0, 0}, level16[2] = {0, 0};
+      audio_kernels::saturating_add(a8.data(), b8.data(), out8.data(), 301);
+      audio_kernels::saturating_add(a16.data(), b16.data(), out16.data(), 301);
+      audio_kernels::saturating_add(a32.data(), b32.data(), out32.data(), 301);
+      audio_kernels::sum_of_squares(a8.data(), 300, 2, level8);
+      audio_kernels::sum_of_squares(a16.data(), 300, 2, level16);
+      audio_kernels::apply_gains(gained8.data(), gains.data(), 301);
+      audio_kernels::apply_gains(gained16.data(), gains.data(), 301);
+      std::vector<int16_t> channel_gained16 = a16;
+      audio_kernels::apply_channel_gains(channel_gained16.data(), 301, 3, channel_gains, 1);
+      REQUIRE(out8 == sum8);
+      REQUIRE(out16 == sum16);
+      REQUIRE(out32 == sum32);
+      REQUIRE(level8[0] == squares8[0]);
+      REQUIRE(level8[1] == squares8[1]);
+      REQUIRE(level16[0] == squares16[0]);
+      REQUIRE(level16[1] == squares16[1]);
+      REQUIRE(gained8 == scaled8);
+      REQUIRE(gained16 == scaled16);
+      REQUIRE(channel_gained16 == channels16);
+    }
+    audio_kernels::set_isa(original);
+    REQUIRE(audio_kernels::active_isa() == original);
+  }
+
+  TEST_CASE("Surround clips", "[Channels]"){
+    typedef std::array<int16_t, 6> frame;
+    std::vector<frame> v = {{{100, 200, 300, 400, 500, 600}}, {{-100, -200, -300, -400, -500, -600}},
+                            {{30000, 1, 2, 3, 4, 5}}};
+    audio<frame> a = audio<frame>(v, 2);
+    std::array<float, 6> rms = a.calculate_rms(std::make_pair(0, 1));
+    REQUIRE(rms[0] == 100);
+    REQUIRE(rms[5] == 600);
+    std::array<float, 6> gains = {{1, 0.5f, 0, 1, 1, 2}};
+    audio<frame> b = a * gains;
+    REQUIRE(b[0][1] == 100);
+    REQUIRE(b[0][2] == 0);
+    REQUIRE(b[1][5] == -1200);
+    audio<frame> c = a + a;
+    REQUIRE(c[2][0] == 32767);
+    REQUIRE(c[1][3] == -800);
+    REQUIRE((a | a).size() == 6);
+    REQUIRE((a ^ std::make_pair(0, 1))[0][0] == 30000);
+    audio<frame> d = a.ranged_add(std::make_pair(1, 2), std::make_pair(0, 1), a);
+    REQUIRE(d.size() == 2);
+    REQUIRE(d[0][4] == 0);
+    REQUIRE(d[1][1] == -199);
+    audio<frame> e = a.normalize(rms, 50);
+    REQUIRE(e[0][0] == 50);
+    REQUIRE(e[0][5] == 50);
+    audio<frame> f = a.fade_in(1);
+    REQUIRE(f[0][3] == 0);
+    REQUIRE(f[1][3] == -200);
+    REQUIRE(f[2][3] == 3);
+    audio<frame> g = a.fade_out(1);
+    REQUIRE(g[1][0] == -50);
+    REQUIRE(g[2][0] == 0);
+    a.reverse();
+    REQUIRE(a[0][0] == 30000);
+  }
+
+  TEST_CASE("Long fades on wide frames", "[Channels]"){
+    typedef std::array<int16_t, 8> frame;
+    frame loud;
+    loud.fill(1000);
+    audio<frame> a = audio<frame>(std::vector<frame>(1000, loud), 1000);
+    a.fade_in_in_place(1);
+    REQUIRE(a[0][7] == 0);
+    for(std::size_t i = 0; i < a.size(); i += 97){
+      for(int c = 1; c < 8; ++c){
+        REQUIRE(a[i][c] == a[i][0]);
+      }
+      REQUIRE(std::abs(a[i][0] - (int)i) <= 1);
+    }
+    audio<frame> b = audio<frame>(std::vector<frame>(300, loud), 1000).fade_out(0.3f);
+    REQUIRE(b[0][0] > 990);
+    REQUIRE(b[0][0] == b[0][7]);
+    REQUIRE(b[299][7] == 0);
+  }
+
+  TEST_CASE("Sample traits", "[Traits]"){
+    using audio_kernels::int24;
+    REQUIRE(sizeof(int24) == 3);
+    REQUIRE((int32_t)int24(-5) == -5);
+    REQUIRE((int32_t)int24(8388607) == 8388607);
+    std::size_t lanes = audio_kernels::sample_traits<int16_t>::lanes;
+    REQUIRE(lanes == 8);
+    audio_kernels::rounding mode = audio_kernels::sample_traits<int16_t>::round_mode;
+    REQUIRE(mode == audio_kernels::rounding::nearest);
+    REQUIRE(audio_kernels::round_to<audio_kernels::rounding::nearest>::apply(-2.5) == -2);
+    REQUIRE(audio_kernels::round_to<audio_kernels::rounding::nearest>::apply(3.5f) == 4);
+    REQUIRE(audio_kernels::round_to<audio_kernels::rounding::nearest>::apply(-2.75f) == -3);
+    REQUIRE(audio_kernels::scale<int16_t>(3, 0.5f) == 2);
+    REQUIRE(audio_kernels::scale<int16_t>(5, 0.5f) == 2);
+    REQUIRE(audio_kernels::scale<int16_t>(-7, 0.3f) == -2);
+    REQUIRE(audio_kernels::scale<int32_t>(1000001, 0.5f) == 500000);
+    REQUIRE(audio_kernels::scale<int32_t>(1000003, 0.5f) == 500002);
+    REQUIRE(audio_kernels::scale<int16_t>(-301, 0.5f) == -150);
+    REQUIRE(audio_kernels::scale<int32_t>(2000000000, 2.0f) == std::numeric_limits<int32_t>::max());
+    REQUIRE(audio_kernels::scale<int8_t>(100, -2.0f) == -128);
+
+    std::vector<int24> v = {int24(8000000), int24(-8000000), int24(3)};
+    audio<int24> a = audio<int24>(v, 10);
+    audio<int24> sum = a + a;
+    REQUIRE((int32_t)sum[0] == 8388607);
+    REQUIRE((int32_t)sum[1] == -8388608);
+    REQUIRE((int32_t)sum[2] == 6);
+    REQUIRE((int32_t)(a * std::make_pair(0.5f, 0.5f))[1] == -4000000);
+    REQUIRE(std::fabs(a.calculate_rms(std::make_pair(0, 1)) - 8000000) < 1);
+
+    std::vector<float> w = {0.75f, -0.5f};
+    audio<float> b = audio<float>(w, 10);
+    REQUIRE((b + b)[0] == 1.5f);
+    REQUIRE((b * std::make_pair(0.5f, 0.5f))[1] == -0.25f);
+  }
+
+  TEST_CASE("Normalize to a target level", "[Normalize]"){
+    std::vector<int16_t> v = {100, -400, 200, 0};
+    audio<int16_t> a = audio<int16_t>(v, 10);
+    REQUIRE(a.view().calculate_peak() == 400);
+    audio<int16_t> peak = a.normalize_to(20000, level_measure::peak);
+    REQUIRE(peak[1] == -20000);
+    REQUIRE(peak[0] == 5000);
+    audio<int16_t> rms = a.normalize_to(a.calculate_rms() * 2);
+    REQUIRE(rms[1] == -800);
+    REQUIRE(a.normalize(0, 1000).get_buffer() == v);
+    REQUIRE(audio<int16_t>(4).normalize(a.calculate_rms(), 1000).get_buffer() == std::vector<int16_t>(4, 0));
+    std::vector<std::pair<int16_t, int16_t>> one_sided(4, std::make_pair(100, 0));
+    audio<std::pair<int16_t, int16_t>> half_silent = audio<std::pair<int16_t, int16_t>>(one_sided, 10);
+    audio<std::pair<int16_t, int16_t>> halves = half_silent.normalize(half_silent.calculate_rms(), 200);
+    REQUIRE(halves[3].first == 200);
+    REQUIRE(halves[3].second == 0);
+    audio<int16_t> loud = a.normalize_to(40000, level_measure::peak);
+    REQUIRE(loud[1] == -32768);
+    REQUIRE(loud[0] == 10000);
+
+    std::vector<std::pair<int16_t, int16_t>> w = {{100, 10}, {-200, -20}, {0, 0}};
+    audio<std::pair<int16_t, int16_t>> b = audio<std::pair<int16_t, int16_t>>(w, 10);
+    audio<std::pair<int16_t, int16_t>> separate = b.normalize_to(1000, level_measure::peak);
+    REQUIRE(separate[1].first == -1000);
+    REQUIRE(separate[1].second == -1000);
+    audio<std::pair<int16_t, int16_t>> linked = b.normalize_to(1000, level_measure::peak, true);
+    REQUIRE(linked[1].first == -1000);
+    REQUIRE(linked[1].second == -100);
+    b.normalize_to_in_place(0, level_measure::rms, true);
+    REQUIRE(b[0].first == 0);
+
+    audio<std::array<int8_t, 3>> silent(4);
+    REQUIRE(silent.normalize_to(50)[0][2] == 0);
+  }
+
+  TEST_CASE("Mixing many clips in one pass", "[Mix]"){
+    std::vector<int8_t> v = {100, 100, 100}, w = {-100, -100, -100};
+    audio<int8_t> a = audio<int8_t>(v, 10), b = audio<int8_t>(w, 10);
+    audio_mixer<int8_t> mixer;
+    mixer.add(a).add(a).add(b, std::make_pair(1.0f, 1.0f), 1).add(b, std::make_pair(0.5f, 0.5f), 3);
+    REQUIRE(mixer.size() == 6);
+    audio<int8_t> mix = mixer.mix();
+    REQUIRE(mix.get_sample_length() == 10);
+    REQUIRE(mix[0] == 127);
+    REQUIRE(mix[1] == 100);
+    REQUIRE(mix[3] == -128);
+    REQUIRE(mix[4] == -50);
+
+    std::vector<std::pair<int16_t, int16_t>> x(20000, std::make_pair(1000, -1000));
+    audio<std::pair<int16_t, int16_t>> c = audio<std::pair<int16_t, int16_t>>(x, 10);
+    audio_mixer<std::pair<int16_t, int16_t>> stereo;
+    for(int i = 0; i < 32; ++i){
+      stereo.add(c, std::make_pair(1.0f, 0.25f), i * 100);
+    }
+    audio<std::pair<int16_t, int16_t>> stems = stereo.mix();
+    REQUIRE(stems.size() == 23100);
+    REQUIRE(stems[50].first == 1000);
+    REQUIRE(stems[10000].first == 32000);
+    REQUIRE(stems[10000].second == -8000);
+    REQUIRE(stems[23099].second == -250);
+  }
+
+  TEST_CASE("Mixes do not depend on the order of the tracks", "[Mix]"){
+    std::vector<float> gains = {0.3333f, 0.3333f, 0.3333f, 1e-3f, 7.77f, -0.6f};
+    std::vector<audio<int16_t>> clips;
+    for(std::size_t t = 0; t < gains.size(); ++t){
+      std::vector<int16_t> v(3000);
+      for(std::size_t i = 0; i < v.size(); ++i){
+        v[i] = (int16_t)(i * 7919 * (t + 1) >> (t * 2));
+      }
+      clips.push_back(audio<int16_t>(v, 10));
+    }
+    std::vector<std::size_t> order = {0, 1, 2, 3, 4, 5};
+    std::vector<int16_t> first;
+    do{
+      audio_mixer<int16_t> mixer;
+      for(std::size_t t : order){
+        mixer.add(clips[t], std::make_pair(gains[t], gains[t]), t * 10);
+      }
+      if(first.empty()){
+        first = mixer.mix().get_buffer();
+      }
+      REQUIRE(mixer.mix().get_buffer() == first);
+    } while(std::next_permutation(order.begin(), order.end()));
+
+    std::vector<audio<int16_t>> close = {audio<int16_t>(std::vector<int16_t>(1, -1)), audio<int16_t>(std::vector<int16_t>(1, -8961)),
+                                         audio<int16_t>(std::vector<int16_t>(1, -2))};
+    std::vector<float> third = {1.0f / 3, 1.0f / 3, 0.3333f};
+    order = {0, 1, 2};
+    do{
+      audio_mixer<int16_t> mixer;
+      for(std::size_t t : order){
+        mixer.add(close[t], std::make_pair(third[t], third[t]));
+      }
+      REQUIRE(mixer.mix()[0] == -2988);
+    } while(std::next_permutation(order.begin(), order.end()));
+
+    std::vector<int32_t> w(3, 1);
+    audio<int32_t> one = audio<int32_t>(w, 10);
+    audio_mixer<int32_t> thirds;
+    thirds.add(one, std::make_pair(0.3333f, 0.3333f)).add(one, std::make_pair(0.3333f, 0.3333f), 1);
+    thirds.add(one, std::make_pair(0.3333f, 0.3333f)).add(one, std::make_pair(NAN, NAN));
+    REQUIRE(thirds.mix().get_buffer() == std::vector<int32_t>({1, 1, 1, 0}));
+  }
+
+  TEST_CASE("Crossfaded concatenation", "[Crossfade]"){
+    std::vector<int16_t> v(1000, 10000), w(600, -10000);
+    audio<int16_t> a = audio<int16_t>(v, 10), b = audio<int16_t>(w, 10);
+    audio<int16_t> joined = a.crossfade(b, 300);
+    REQUIRE(joined.size() == 1300);
+    REQUIRE(joined.get_sample_length() == 10);
+    REQUIRE(joined[699] == 10000);
+    REQUIRE(joined[700] > 9900);
+    REQUIRE(joined[849] == -joined[850]);
+    REQUIRE(joined[849] < 100);
+    REQUIRE(joined[999] < -9900);
+    REQUIRE(joined[1000] == -10000);
+    REQUIRE(a.crossfade(b, 5000).size() == 1000);
+    REQUIRE(a.crossfade(b, 0).get_buffer() == (a | b).get_buffer());
+
+    std::vector<std::pair<int16_t, int16_t>> x(4, std::make_pair(30000, 30000));
+    audio<std::pair<int16_t, int16_t>> c = audio<std::pair<int16_t, int16_t>>(x, 10);
+    audio<std::pair<int16_t, int16_t>> loud = c.crossfade(c, 4);
+    REQUIRE(loud.size() == 4);
+    REQUIRE(loud[1].first == 32767);
+    REQUIRE(loud[0].second > 30000);
+  }
+
+  TEST_CASE("Compressed clips", "[Codec]"){
+    std::vector<int16_t> v(10000);
+    for(std::size_t i = 0; i < v.size(); ++i){
+      v[i] = (int16_t)(20000 * sin(i * 0.01) + (int)(i * 7919 % 13) - 6);
+    }
+    v[5000] = -32768;
+    v[5001] = 32767;
+    audio<int16_t> a = audio<int16_t>(v, 44100);
+    write_compressed("codec_test.audz", a, 1024);
+    compressed_audio<int16_t> packed("codec_test.audz");
+    REQUIRE(packed.size() == 10000);
+    REQUIRE(packed.block_count() == 10);
+    REQUIRE(packed.get_sample_length() == 44100);
+    REQUIRE(packed.compressed_bytes() < v.size() * sizeof(int16_t) / 2);
+    REQUIRE(packed.to_audio().get_buffer() == v);
+    REQUIRE(packed.read(std::make_pair(4990, 5010)).get_buffer() == a.view(std::make_pair(4990, 5010)).to_audio().get_buffer());
+    REQUIRE(packed.read(std::make_pair(9990, 20000)).size() == 10);
+    REQUIRE(packed.read(std::make_pair(9000, INT32_MAX)).size() == 1000);
+    REQUIRE(packed.read(std::make_pair(5, 4)).size() == 0);
+    typedef compressed_audio<std::pair<int16_t, int16_t>> stereo_packed;
+    REQUIRE_THROWS(stereo_packed("codec_test.audz"));
+
+    std::vector<std::pair<int32_t, int32_t>> w = {{INT32_MIN, INT32_MAX}, {INT32_MAX, INT32_MIN}, {0, -1}, {12345, 54321}, {INT32_MIN, 0}};
+    audio<std::pair<int32_t, int32_t>> b = audio<std::pair<int32_t, int32_t>>(w, 8);
+    write_compressed("codec_test.audz", b, 2);
+    compressed_audio<std::pair<int32_t, int32_t>> wide("codec_test.audz");
+    REQUIRE(wide.to_audio().get_buffer() == w);
+    REQUIRE(wide.read(std::make_pair(1, 3)).get_buffer()[2].second == 54321);
+
+    audio<int8_t> empty = audio<int8_t>(0);
+    write_compressed("codec_test.audz", empty);
+    REQUIRE(compressed_audio<int8_t>("codec_test.audz").to_audio().size() == 0);
+    std::remove("codec_test.audz");
+  }
+
+  TEST_CASE("Corrupt compressed clips", "[Codec]"){
+    std::vector<int16_t> v(10000);
+    for(std::size_t i = 0; i < v.size(); ++i){
+      v[i] = (int16_t)(i * 7919);
+    }
+    write_compressed("codec_test.audz", audio<int16_t>(v, 44100), 1024);
+    std::ifstream in("codec_test.audz", std::ios::binary);
+    const std::vector<uint8_t> good((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+    auto write = [](const std::vector<uint8_t>& bytes, std::size_t size){
+      std::ofstream out("codec_test.audz", std::ios::binary | std::ios::trunc);
+      out.write(reinterpret_cast<const char*>(bytes.data()), size);
+    };
+    auto patch = [&](std::size_t at, uint64_t value, int count){
+      std::vector<uint8_t> bytes = good;
+      for(int i = 0; i < count; ++i){
+        bytes[at + i] = (uint8_t)(value >> (8 * i));
+      }
+      write(bytes, bytes.size());
+    };
+    std::size_t index = audio_codec::header_bytes, data = index + 10 * 8;
+    uint64_t block5 = audio_codec::get(good.data() + index + 4 * 8, 8);
+
+    audio_parallel::set_threads(4);
+    patch(data + block5, good[data + block5] | 7, 1);
+    compressed_audio<int16_t> bad_block("codec_test.audz");
+    REQUIRE_THROWS(bad_block.to_audio());
+    REQUIRE(bad_block.read(std::make_pair(0, 2047)).get_buffer() == std::vector<int16_t>(v.begin(), v.begin() + 2048));
+    audio_parallel::set_threads(std::thread::hardware_concurrency());
+
+    patch(index + 3 * 8, audio_codec::get(good.data() + index + 1 * 8, 8), 8);
+    REQUIRE_THROWS(compressed_audio<int16_t>("codec_test.audz"));
+    patch(index + 9 * 8, good.size(), 8);
+    REQUIRE_THROWS(compressed_audio<int16_t>("codec_test.audz"));
+    std::vector<uint8_t> huge = good;
+    for(int i = 0; i < 8; ++i){
+      huge[12 + i] = (uint8_t)(((uint64_t)1024 * 0xffff0000u) >> (8 * i));
+    }
+    for(int i = 0; i < 4; ++i){
+      huge[24 + i] = (uint8_t)(0xffff0000u >> (8 * i));
+    }
+    write(huge, huge.size());
+    REQUIRE_THROWS(compressed_audio<int16_t>("codec_test.audz"));
+    write(good, good.size() - 1);
+    REQUIRE_THROWS(compressed_audio<int16_t>("codec_test.audz"));
+    write(good, good.size());
+    REQUIRE(compressed_audio<int16_t>("codec_test.audz").to_audio().get_buffer() == v);
+    std::remove("codec_test.audz");
+  }
+
+  TEST_CASE("Three stage pipeline", "[Pipeline]"){
+    std::vector<int> written;
+    int next = 0;
+    pipeline_report report = run_pipeline<std::vector<int>>(2,
+      [&](std::vector<int>& item){
+        item.assign(1, next);
+        return next++ < 10;
+      },
+      [&](std::vector<int>& item){ item[0] *= 3; },
+      [&](std::vector<int>& item){ written.push_back(item[0]); });
+    REQUIRE(report.blocks == 10);
+    REQUIRE(written.size() == 10);
+    REQUIRE(written[9] == 27);
+    REQUIRE(report.utilization(pipeline_stage::write) >= 0);
+    REQUIRE(report.utilization(pipeline_stage::write) <= 1);
+
+    next = 0;
+    REQUIRE_THROWS(run_pipeline<int>(2,
+      [&](int& item){ item = next++; return true; },
+      [&](int& item){ if(item == 5) throw std::runtime_error("stage failed"); },
+      [&](int&){}));
+
+    write_raw_file<int16_t>("pipeline_in.raw", std::vector<int16_t>(1000, 100));
+    pipeline_report streamed = audio_stream<int16_t>("pipeline_in.raw", 2, 64).set_depth(3).volume({2, 2}).run("pipeline_out.raw");
+    REQUIRE(streamed.blocks == 16);
+    REQUIRE(read_raw_file<int16_t>("pipeline_out.raw") == std::vector<int16_t>(1000, 200));
+    std::remove("pipeline_in.raw");
+    std::remove("pipeline_out.raw");
+  }
+
+  TEST_CASE("Batch manifests", "[Batch]"){
+    using namespace audioops;
+    job defaults = {8000, 16, 1, "out", "", {}, {}};
+    job cut = parse_job({"-o", "short", "-c", "2", "-cut", "1", "2", "a.raw"}, defaults);
+    REQUIRE(cut.operation == "-cut");
+    REQUIRE(cut.numbers.size() == 2);
+    REQUIRE(cut.inputs[0] == "a.raw");
+    REQUIRE(output_path(cut) == "short_8000_16_stereo.raw");
+    REQUIRE_THROWS(parse_job({"-v", "1", "a.raw"}, defaults));
+    REQUIRE_THROWS(parse_job({"-rev", "a.raw", "b.raw"}, defaults));
+    REQUIRE_THROWS(parse_job({"-b", "12", "-rev", "a.raw"}, defaults));
+
+    std::istringstream manifest("# comment\n-o loud -v 2 2 a.raw\n\n-rms a.raw\n-rms b.raw\n-o quiet -v 0.5 0.5 a.raw\n");
+    std::vector<job> jobs = read_manifest(manifest, "m", defaults);
+    REQUIRE(jobs.size() == 4);
+    REQUIRE(jobs[3].output == "quiet");
+    std::istringstream clash("-v 2 2 a.raw\n-rev a.raw\n");
+    REQUIRE_THROWS(read_manifest(clash, "m", defaults));
+
+    write_raw_file<int16_t>("batch_a.raw", {0, 0, 0, 0});
+    std::vector<job> shared = {parse_job({"-o", "batch_x", "-rev", "batch_a.raw"}, defaults),
+                               parse_job({"-o", "batch_y", "-norm", "100", "100", "batch_a.raw"}, defaults)};
+    memory_budget memory(10);
+    clip_cache cache(shared, memory);
+    REQUIRE(cache.hold(shared[0]) == 8);
+    memory.admit(8);
+    std::shared_ptr<const audio<int16_t>> first = cache.get<int16_t>(shared[0], "batch_a.raw");
+    REQUIRE(cache.hold(shared[1]) == 0);
+    REQUIRE(cache.get<int16_t>(shared[1], "batch_a.raw") == first);
+    REQUIRE(cache.loaded() == 1);
+    cache.release(shared[0]);
+    memory.finish(0);
+    REQUIRE(cache.loaded() == 1);
+    REQUIRE(memory.in_use() == 8);
+    REQUIRE_FALSE(cache.reclaim());
+    cache.release(shared[1]);
+    REQUIRE(cache.loaded() == 0);
+    REQUIRE(memory.in_use() == 0);
+
+    clip_cache later(shared, memory);
+    memory.admit(later.hold(shared[0]));
+    later.get<int16_t>(shared[0], "batch_a.raw");
+    later.release(shared[0]);
+    memory.finish(0);
+    REQUIRE(memory.in_use() == 8);
+    memory.admit(5, [&]{ return later.reclaim(); });
+    REQUIRE(later.loaded() == 0);
+    REQUIRE(memory.in_use() == 5);
+    memory.finish(5);
+    REQUIRE(later.hold(shared[1]) == 8);
+
+    std::vector<std::string> reports, errors;
+    run_batch(shared, 2, 1, reports, errors);
+    REQUIRE(errors[1].empty());
+    REQUIRE(read_raw_file<int16_t>("batch_y_8000_16_mono.raw") == std::vector<int16_t>(4, 0));
+
+    memory_budget small(100);
+    small.admit(1000);
+    REQUIRE(small.in_use() == 1000);
+    small.finish(1000);
+    std::remove("batch_a.raw");
+    std::remove("batch_x_8000_16_mono.raw");
+    std::remove("batch_y_8000_16_mono.raw");
+  }
@@ -0,0 +1,94 @@
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "audioops.h"
+
+using namespace audioops;
+
+// audioops: runs one edit given on the command line, or every line of a
+// manifest in a single process.
+
+static const char* usage =
+  "usage: audioops -r rate -b bits -c channels [-o out] <op> file1 [file2]\n"
+  "       audioops [-r rate -b bits -c channels] [-j threads] [-M megabytes] -m manifest\n"
+  "ops:   -add | -cut r1 r2 | -radd r1 r2 s1 s2 | -cat | -v r1 r2 | -rev | -rms\n"
+  "       -norm r1 r2 | -fadein seconds | -fadeout seconds\n"
+  "cut ranges are in samples and radd ranges in seconds, both inclusive. Every\n"
+  "manifest line holds the options of one job; blank lines and # comments are\n"
+  "skipped, and -r, -b and -c given before -m are the defaults for every line.\n"
+  "Jobs that write a clip need an output name of their own.\n";
+
+int main(int argc, char* argv[]){
+  job defaults = {0, 16, 1, "out", "", {}, {}};
+  std::vector<std::string> tokens(argv + 1, argv + argc);
+  std::vector<job> jobs;
+  unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+  std::size_t budget = (std::size_t)1 << 30;
+  try{
+    auto manifest = std::find(tokens.begin(), tokens.end(), "-m");
+    if(manifest == tokens.end()){
+      jobs.push_back(parse_job(tokens, defaults));
+    }
+    else{
+      if(manifest + 1 == tokens.end()){
+        throw std::invalid_argument("-m needs a manifest");
+      }
+      std::string manifest_path = *(manifest + 1);
+      tokens.erase(manifest, manifest + 2);
+      for(std::size_t i = 0; i < tokens.size(); i += 2){
+        if(i + 1 == tokens.size()){
+          throw std::invalid_argument(tokens[i] + " needs a value");
+        }
+        const std::string& option = tokens[i];
+        double value = parse_number(tokens[i + 1]);
+        if(option == "-r"){
+          defaults.rate = (int)value;
+        }
+        else if(option == "-b"){
+          defaults.bits = (int)value;
+        }
+        else if(option == "-c"){
+          defaults.channels = (int)value;
+        }
+        else if(option == "-j"){
+          threads = std::max(1, (int)value);
+        }
+        else if(option == "-M"){
+          budget = (std::size_t)(value * (1 << 20));
+        }
+        else{
+          throw std::invalid_argument("unknown option " + option);
+        }
+      }
+      std::ifstream file(manifest_path);
+      if(!file){
+        throw std::runtime_error("cannot open " + manifest_path);
+      }
+      jobs = read_manifest(file, manifest_path, defaults);
+    }
+  }
+  catch(const std::exception& error){
+    std::fprintf(stderr, "audioops: %s\n%s", error.what(), usage);
+    return 2;
+  }
+
+  std::vector<std::string> reports, errors;
+  run_batch(jobs, threads, budget, reports, errors);
+
+  int status = 0;
+  for(std::size_t i = 0; i < jobs.size(); ++i){
+    if(!errors[i].empty()){
+      std::fprintf(stderr, "audioops: job %zu: %s\n", i + 1, errors[i].c_str());
+      status = 1;
+    }
+    else if(!reports[i].empty()){
+      std::printf("%s\n", reports[i].c_str());
+    }
+  }
+  return status;
+}
@@ -0,0 +1,481 @@
+#ifndef AUDIOOPS_H
+#define AUDIOOPS_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <istream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "audio.h"
+#include "audio_io.h"
+#include "audio_parallel.h"
+
+// The batch engine behind audioops. Jobs run on a fixed set of threads, each
+// input file is read once however many jobs use it, and a memory budget
+// holds jobs back until the clips already in flight have been released.
+namespace audioops{
+
+struct job{
+  int rate;
+  int bits;
+  int channels;
+  std::string output;
+  std::string operation;
+  std::vector<float> numbers;
+  std::vector<std::string> inputs;
+};
+
+// what each operation takes: numeric arguments and input files
+inline bool operation_shape(const std::string& operation, std::size_t& numbers, std::size_t& inputs){
+  static const std::map<std::string, std::pair<std::size_t, std::size_t>> shapes = {
+    {"-add", {0, 2}}, {"-cut", {2, 1}}, {"-radd", {4, 2}}, {"-cat", {0, 2}}, {"-v", {2, 1}}, {"-rev", {0, 1}},
+    {"-rms", {0, 1}}, {"-norm", {2, 1}}, {"-fadein", {1, 1}}, {"-fadeout", {1, 1}}};
+  auto shape = shapes.find(operation);
+  if(shape == shapes.end()){
+    return false;
+  }
+  numbers = shape->second.first;
+  inputs = shape->second.second;
+  return true;
+}
+
+inline double parse_number(const std::string& token){
+  char* end = nullptr;
+  double value = std::strtod(token.c_str(), &end);
+  if(token.empty() || *end != '\0'){
+    throw std::invalid_argument("not a number: " + token);
+  }
+  return value;
+}
+
+// fills the job from the options of one command line or manifest line
+inline job parse_job(const std::vector<std::string>& tokens, job result){
+  std::size_t i = 0;
+  auto next = [&](const std::string& option){
+    if(i + 1 >= tokens.size()){
+      throw std::invalid_argument(option + " needs a value");
+    }
+    return tokens[++i];
+  };
+  for(; i < tokens.size() && result.operation.empty(); ++i){
+    const std::string& token = tokens[i];
+    std::size_t numbers = 0, inputs = 0;
+    if(token == "-r"){
+      result.rate = (int)parse_number(next(token));
+    }
+    else if(token == "-b"){
+      result.bits = (int)parse_number(next(token));
+    }
+    else if(token == "-c"){
+      result.channels = (int)parse_number(next(token));
+    }
+    else if(token == "-o"){
+      result.output = next(token);
+    }
+    else if(operation_shape(token, numbers, inputs)){
+      result.operation = token;
+      for(std::size_t n = 0; n < numbers; ++n){
+        result.numbers.push_back((float)parse_number(next(token)));
+      }
+      for(std::size_t n = 0; n < inputs; ++n){
+        result.inputs.push_back(next(token));
+      }
+    }
+    else{
+      throw std::invalid_argument("unknown option " + token);
+    }
+  }
+  if(result.operation.empty()){
+    throw std::invalid_argument("no operation given");
+  }
+  if(i != tokens.size()){
+    throw std::invalid_argument("unexpected " + tokens[i]);
+  }
+  if(result.rate <= 0){
+    throw std::invalid_argument("a positive sample rate is required");
+  }
+  if(result.bits != 8 && result.bits != 16 && result.bits != 24 && result.bits != 32){
+    throw std::invalid_argument("bits must be 8, 16, 24 or 32");
+  }
+  if(result.channels != 1 && result.channels != 2){
+    throw std::invalid_argument("channels must be 1 or 2");
+  }
+  return result;
+}
+
+inline std::vector<std::string> split(const std::string& line){
+  std::istringstream words(line.substr(0, line.find('#')));
+  std::vector<std::string> tokens;
+  for(std::string word; words >> word;){
+    tokens.push_back(word);
+  }
+  return tokens;
+}
+
+// the output name carries the format, as in out_44100_16_stereo.raw
+inline std::string output_path(const job& j){
+  return j.output + "_" + std::to_string(j.rate) + "_" + std::to_string(j.bits) + "_" +
+         (j.channels == 1 ? "mono" : "stereo") + ".raw";
+}
+
+inline std::size_t file_bytes(const std::string& path){
+  struct stat info;
+  return stat(path.c_str(), &info) == 0 ? (std::size_t)info.st_size : 0;
+}
+
+// Bytes held by running jobs and by the clips cached for later ones. A job
+// that does not fit first asks reclaim to drop idle cached clips, then waits
+// for others to finish; one asking for more than the whole budget is admitted
+// once no other job is running rather than never.
+class memory_budget{
+private:
+  std::size_t capacity;
+  std::size_t used;
+  std::size_t running;
+  std::size_t changes;
+  std::mutex lock;
+  std::condition_variable changed;
+
+public:
+  explicit memory_budget(std::size_t bytes) : capacity(bytes), used(0), running(0), changes(0){}
+
+  void admit(std::size_t bytes, const std::function<bool()>& reclaim = nullptr){
+    std::unique_lock<std::mutex> guard(lock);
+    while(used + bytes > capacity){
+      std::size_t seen = changes;
+      if(reclaim){
+        guard.unlock();
+        bool reclaimed = reclaim();
+        guard.lock();
+        if(reclaimed){
+          continue;
+        }
+      }
+      if(running == 0){
+        break;
+      }
+      changed.wait(guard, [&]{ return changes != seen; });
+    }
+    used += bytes;
+    ++running;
+  }
+
+  // a job is done and returns what it did not hand on to the cache
+  void finish(std::size_t bytes){
+    std::lock_guard<std::mutex> guard(lock);
+    used -= bytes;
+    --running;
+    ++changes;
+    changed.notify_all();
+  }
+
+  // a cached clip is dropped
+  void release(std::size_t bytes){
+    std::lock_guard<std::mutex> guard(lock);
+    used -= bytes;
+    ++changes;
+    changed.notify_all();
+  }
+
+  std::size_t in_use(){
+    std::lock_guard<std::mutex> guard(lock);
+    return used;
+  }
+};
+
+// Loaded inputs shared between jobs. Every entry knows how many jobs still
+// need it and is dropped after the last one; concurrent requests for a file
+// that is still loading wait for the one read. A clip is charged to the
+// budget from the moment a job that will read it is admitted until it is
+// dropped, and clips no running job holds may be dropped early to make room.
+class clip_cache{
+private:
+  struct entry{
+    std::shared_future<std::shared_ptr<void>> clip;
+    std::size_t users;
+    std::size_t holders;
+    std::size_t charge;
+  };
+
+  std::map<std::string, entry> entries;
+  memory_budget& memory;
+  std::mutex lock;
+
+  void drop(entry& e){
+    memory.release(e.charge);
+    e.clip = std::shared_future<std::shared_ptr<void>>();
+    e.charge = 0;
+  }
+
+public:
+  static std::string key(const job& j, const std::string& path){
+    return path + "|" + std::to_string(j.rate) + "|" + std::to_string(j.bits) + "|" + std::to_string(j.channels);
+  }
+
+  clip_cache(const std::vector<job>& jobs, memory_budget& budget) : memory(budget){
+    for(const job& j : jobs){
+      for(const std::string& path : j.inputs){
+        ++entries[key(j, path)].users;
+      }
+    }
+  }
+
+  // keeps the inputs of j from being dropped while it runs; returns the bytes
+  // of those still to be read, which the job must be admitted with
+  std::size_t hold(const job& j){
+    std::lock_guard<std::mutex> guard(lock);
+    std::size_t bytes = 0;
+    for(const std::string& path : j.inputs){
+      entry& e = entries[key(j, path)];
+      if(e.holders++ == 0 && !e.clip.valid()){
+        e.charge = file_bytes(path);
+        bytes += e.charge;
+      }
+    }
+    return bytes;
+  }
+
+  // drops one loaded clip no running job holds; false if there is none
+  bool reclaim(){
+    std::lock_guard<std::mutex> guard(lock);
+    for(auto& e : entries){
+      if(e.second.holders == 0 && e.second.clip.valid()){
+        drop(e.second);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  template<typename T>
+  std::shared_ptr<const audio<T>> get(const job& j, const std::string& path){
+    std::promise<std::shared_ptr<void>> loader;
+    std::shared_future<std::shared_ptr<void>> clip;
+    bool load = false;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      entry& e = entries[key(j, path)];
+      if(!e.clip.valid()){
+        e.clip = loader.get_future().share();
+        load = true;
+      }
+      clip = e.clip;
+    }
+    if(load){
+      try{
+        loader.set_value(std::make_shared<audio<T>>(mapped_audio<T>(path, j.rate).to_audio()));
+      }
+      catch(...){
+        loader.set_exception(std::current_exception());
+      }
+    }
+    return std::static_pointer_cast<const audio<T>>(clip.get());
+  }
+
+  // inputs read and still held for a later job
+  std::size_t loaded(){
+    std::lock_guard<std::mutex> guard(lock);
+    std::size_t count = 0;
+    for(const auto& e : entries){
+      count += e.second.clip.valid();
+    }
+    return count;
+  }
+
+  void release(const job& j){
+    std::lock_guard<std::mutex> guard(lock);
+    for(const std::string& path : j.inputs){
+      auto e = entries.find(key(j, path));
+      if(e == entries.end()){
+        continue;
+      }
+      entry& held = e->second;
+      if(--held.users == 0){
+        drop(held);
+        entries.erase(e);
+      }
+      else if(--held.holders == 0 && !held.clip.valid()){
+        drop(held);
+      }
+    }
+  }
+};
+
+template<typename T>
+void write_clip(const std::string& path, const audio<T>& clip){
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  file.write(reinterpret_cast<const char*>(clip.data()), clip.size() * sizeof(T));
+  if(!file){
+    throw std::runtime_error("cannot write " + path);
+  }
+}
+
+inline std::pair<int, int> seconds_range(float first, float last, int rate){
+  return std::make_pair((int)(first * rate), (int)(last * rate));
+}
+
+// silent channels keep their gain of one, as in normalize_to
+template<typename T>
+audio<T> normalize(const audio<T>& clip, float desired, float){
+  return clip.normalize_to(desired);
+}
+
+template<typename T>
+audio<std::pair<T, T>> normalize(const audio<std::pair<T, T>>& clip, float desired_left, float desired_right){
+  std::pair<float, float> gains = clip.view().normalize_gains(desired_left);
+  gains.second = clip.view().normalize_gains(desired_right).second;
+  return clip * gains;
+}
+
+inline std::string format_rms(float rms){
+  return std::to_string(rms);
+}
+
+inline std::string format_rms(const std::pair<float, float>& rms){
+  return std::to_string(rms.first) + " " + std::to_string(rms.second);
+}
+
+// runs one job on frames of type T; returns what it reports
+template<typename T>
+std::string run_job(const job& j, clip_cache& cache){
+  std::shared_ptr<const audio<T>> first = cache.get<T>(j, j.inputs[0]);
+  std::shared_ptr<const audio<T>> second = j.inputs.size() > 1 ? cache.get<T>(j, j.inputs[1]) : first;
+  const std::vector<float>& n = j.numbers;
+  audio<T> result;
+  if(j.operation == "-rms"){
+    return j.inputs[0] + ": " + format_rms(first->calculate_rms());
+  }
+  else if(j.operation == "-add"){
+    result = *first + *second;
+  }
+  else if(j.operation == "-cut"){
+    result = *first ^ std::make_pair((int)n[0], (int)n[1]);
+  }
+  else if(j.operation == "-radd"){
+    result = first->ranged_add(seconds_range(n[0], n[1], j.rate), seconds_range(n[2], n[3], j.rate), *second);
+  }
+  else if(j.operation == "-cat"){
+    result = *first | *second;
+  }
+  else if(j.operation == "-v"){
+    result = *first * std::make_pair(n[0], n[1]);
+  }
+  else if(j.operation == "-rev"){
+    result = *first;
+    result.reverse();
+  }
+  else if(j.operation == "-norm"){
+    result = normalize(*first, n[0], n[1]);
+  }
+  else if(j.operation == "-fadein"){
+    result = first->fade_in(n[0]);
+  }
+  else{
+    result = first->fade_out(n[0]);
+  }
+  write_clip(output_path(j), result);
+  return "";
+}
+
+template<typename S>
+std::string run_channels(const job& j, clip_cache& cache){
+  return j.channels == 1 ? run_job<S>(j, cache) : run_job<std::pair<S, S>>(j, cache);
+}
+
+inline std::string run(const job& j, clip_cache& cache){
+  switch(j.bits){
+    case 8:
+      return run_channels<int8_t>(j, cache);
+    case 16:
+      return run_channels<int16_t>(j, cache);
+    case 24:
+      return run_channels<audio_kernels::int24>(j, cache);
+    default:
+      return run_channels<int32_t>(j, cache);
+  }
+}
+
+// besides its inputs, which the cache accounts for, a job holds at worst two
+// clips of their combined size
+inline std::size_t job_bytes(const job& j){
+  std::size_t bytes = 0;
+  for(const std::string& path : j.inputs){
+    bytes += file_bytes(path);
+  }
+  return 2 * bytes;
+}
+
+// Every job of a manifest, one per line, starting from defaults. Jobs that
+// write may not share an output file, since they would overwrite each other.
+inline std::vector<job> read_manifest(std::istream& in, const std::string& name, const job& defaults){
+  std::vector<job> jobs;
+  std::map<std::string, std::size_t> outputs;
+  std::size_t line_number = 0;
+  for(std::string line; std::getline(in, line);){
+    ++line_number;
+    std::vector<std::string> words = split(line);
+    if(words.empty()){
+      continue;
+    }
+    std::string where = name + ":" + std::to_string(line_number) + ": ";
+    try{
+      jobs.push_back(parse_job(words, defaults));
+    }
+    catch(const std::exception& error){
+      throw std::invalid_argument(where + error.what());
+    }
+    if(jobs.back().operation != "-rms"){
+      std::string path = output_path(jobs.back());
+      if(outputs.count(path)){
+        throw std::invalid_argument(where + path + " is already written by line " + std::to_string(outputs[path]) +
+                                    "; give each job its own -o");
+      }
+      outputs[path] = line_number;
+    }
+  }
+  return jobs;
+}
+
+// Runs jobs on a pool of threads workers within budget bytes. reports and
+// errors get one entry per job, empty when a job has nothing to say. With
+// more than one worker each job runs its operators serially, since work
+// started from inside a pool task runs inline; a single worker leaves them to
+// the operator pool.
+inline void run_batch(const std::vector<job>& jobs, unsigned threads, std::size_t budget,
+                      std::vector<std::string>& reports, std::vector<std::string>& errors){
+  threads = (unsigned)std::max<std::size_t>(1, std::min<std::size_t>(threads, jobs.size()));
+  memory_budget memory(budget);
+  clip_cache cache(jobs, memory);
+  reports.assign(jobs.size(), "");
+  errors.assign(jobs.size(), "");
+  audio_parallel::thread_pool workers(threads);
+  workers.run(jobs.size(), [&](std::size_t i){
+    std::size_t working = job_bytes(jobs[i]);
+    memory.admit(working + cache.hold(jobs[i]), [&]{ return cache.reclaim(); });
+    try{
+      reports[i] = run(jobs[i], cache);
+    }
+    catch(const std::exception& error){
+      errors[i] = error.what();
+    }
+    cache.release(jobs[i]);
+    memory.finish(working);
+  });
+}
+}
+
+#endif